@@ -51,8 +51,20 @@
 
 #include "mmd.h"
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif /* !_WIN32 */
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif /* __SSE2__ */
+#if !defined(_WIN32) && !defined(MMD_NO_THREADS)
+#  include <pthread.h>
+#  define MMD_HAVE_THREADS 1
+#endif /* !_WIN32 && !MMD_NO_THREADS */
 
 
 /*
@@ -71,6 +83,56 @@
 #endif /* _WIN32 */
 
 
+/*
+ * Constants...
+ */
+
+#define MMD_ARENA_MIN	4096		/* Initial size of arena chunks */
+#define MMD_ARENA_MAX	1048576		/* Maximum size of arena chunks */
+#define MMD_BUFFER_SIZE	65536		/* Size of stdio read buffer */
+#define MMD_MAP_MIN	65536		/* Minimum size of memory-mapped files */
+#define MMD_JOB_BATCH	64		/* Number of inline parsing jobs a thread claims at once */
+#ifndef MMD_SECTION_MIN
+#  define MMD_SECTION_MIN 1048576	/* Minimum size of a section parsed on its own thread */
+#endif /* !MMD_SECTION_MIN */
+
+#define MMD_JOB_QUEUED	0		/* Inline parsing job waiting for a thread */
+#define MMD_JOB_CHAINED	1		/* Job is parsed along with the job before it */
+#define MMD_JOB_DONE	2		/* Job has already been parsed */
+
+#define MMD_CHAR_SPACE	0x01		/* Whitespace (" \t\n\v\f\r") */
+#define MMD_CHAR_BLANK	0x02		/* Space or tab */
+#define MMD_CHAR_DIGIT	0x04		/* Decimal digit */
+#define MMD_CHAR_PUNCT	0x08		/* ASCII punctuation */
+#define MMD_CHAR_BULLET	0x10		/* List bullet ("-+*") */
+#define MMD_CHAR_TABLE	0x20		/* Table divider (" \t:-|") */
+#define MMD_CHAR_INDENT	0x40		/* Block quote indentation (" \t>") */
+#define MMD_CHAR_INLINE	0x80		/* Start of inline markup ("!*<[_`~") */
+
+#define MMD_BLOCK_FENCE	0x01		/* Code fence ("`~") */
+#define MMD_BLOCK_BREAK	0x02		/* Thematic break ("-_*") */
+#define MMD_BLOCK_SETEXT 0x04		/* Setext heading underline ("-=") */
+#define MMD_BLOCK_BULLET 0x08		/* Unordered list item ("-+*") */
+#define MMD_BLOCK_ORDERED 0x10		/* Ordered list item (digits) */
+#define MMD_BLOCK_HEADING 0x20		/* ATX heading ("#") */
+
+#define MMD_LINE_BLANK	0x01		/* Line is blank */
+#define MMD_LINE_QUOTE	0x02		/* Line starts with ">" */
+#define MMD_LINE_BREAK	0x04		/* Line starts a block that ends a paragraph */
+#define MMD_LINE_TABLE	0x08		/* Line can be a table divider */
+
+
+/*
+ * Macros...
+ */
+
+#define mmd_ischar(ch,cls)	(mmd_chars[(ch) & 255] & (cls))
+#define mmd_isdigit(ch)		mmd_ischar(ch, MMD_CHAR_DIGIT)
+#define mmd_ispunct(ch)		mmd_ischar(ch, MMD_CHAR_PUNCT)
+#define mmd_isspace(ch)		mmd_ischar(ch, MMD_CHAR_SPACE)
+#define mmd_tolower(ch)		(((ch) >= 'A' && (ch) <= 'Z') ? ((ch) | 0x20) : (ch))
+
+
 /*
  * Structures...
  */
@@ -78,10 +140,12 @@
 struct _mmd_s
 {
   mmd_type_t	type;			/* Node type */
-  int		whitespace;		/* Leading whitespace? */
+  short		whitespace,		/* Leading whitespace? */
+		span;			/* Text is a span of the document source? */
   char		*text,			/* Text */
 		*url,			/* Reference URL (image/link/etc.) */
 		*extra;			/* Title, language name, etc. */
+  size_t	textlen;		/* Length of text */
   mmd_t		*parent,		/* Parent node */
 		*first_child,		/* First child node */
 		*last_child,		/* Last child node */
@@ -89,30 +153,117 @@ struct _mmd_s
 		*next_sibling;		/* Next sibling node */
 };
 
-typedef struct _mmd_filebuf_s		/**** Buffered file ****/
+typedef struct _mmd_chunk_s		/**** Memory arena chunk ****/
+{
+  struct _mmd_chunk_s *next;		/* Next (older) chunk */
+  size_t	size,			/* Size of chunk data */
+		used;			/* Bytes used in chunk data */
+} _mmd_chunk_t;
+
+typedef struct _mmd_arena_s		/**** Memory arena ****/
+{
+  _mmd_chunk_t	*chunks;		/* Current chunk */
+  size_t	chunksize;		/* Size of next chunk */
+} _mmd_arena_t;
+
+typedef struct _mmd_root_s		/**** Document root node ****/
+{
+  mmd_t		node;			/* Document node (must be first) */
+  _mmd_arena_t	arena;			/* Memory for all child nodes and text */
+} _mmd_root_t;
+
+typedef struct _mmd_line_s		/**** Line record ****/
 {
-  FILE		*fp;			/* File pointer */
-  char		buffer[65536],		/* Buffer */
-		*bufptr,		/* Pointer into buffer */
-		*bufend;		/* End of buffer */
+  char		*end;			/* End of line, after the newline, or NULL if unknown */
+  int		flags,			/* MMD_LINE_ flags */
+		quote,			/* Length of leading " \t>" characters */
+		textoffset;		/* Offset of text after any block markup */
+} _mmd_line_t;
+
+typedef struct _mmd_filebuf_s		/**** Input buffer ****/
+{
+  char		*bufptr,		/* Pointer into buffer */
+		*bufend,		/* End of buffer */
+		*nextptr,		/* Start of next buffer, if any */
+		*nextend;		/* End of next buffer */
+  _mmd_line_t	lines[2];		/* Records for current and next lines, if known */
+  int		resident,		/* Buffer is kept with the document? */
+		nextresident;		/* Next buffer is kept with the document? */
+  const char	*linesrc;		/* Source of last line, if resident */
+  size_t	linevalid;		/* Number of bytes matching the source */
 } _mmd_filebuf_t;
 
 typedef struct _mmd_ref_s		/**** Reference link ****/
 {
   char		*name,			/* Name of reference */
-		*url,			/* Reference URL */
-		*title;			/* Title, if any */
-  size_t	num_pending;		/* Number of pending nodes */
-  mmd_t		**pending;		/* Pending nodes */
+		*url,			/* Reference URL (in document arena) */
+		*title;			/* Title, if any (in document arena) */
 } _mmd_ref_t;
 
+typedef struct _mmd_refop_s		/**** Reference operation to replay ****/
+{
+  mmd_t		*node;			/* Link node, if any */
+  const char	*name,			/* Reference name */
+		*url,			/* Reference URL, if any */
+		*title;			/* Title, if any */
+} _mmd_refop_t;
+
+typedef struct _mmd_refops_s		/**** Log of reference operations ****/
+{
+  size_t	num_ops,		/* Number of operations */
+		alloc_ops;		/* Allocated operations */
+  _mmd_refop_t	*ops;			/* Operations */
+} _mmd_refops_t;
+
+typedef struct _mmd_pending_s		/**** Link waiting for its reference ****/
+{
+  mmd_t		*node;			/* Link node */
+  size_t	ref;			/* Index of reference */
+} _mmd_pending_t;
+
 typedef struct _mmd_doc_s		/**** Markdown document ****/
 {
   mmd_t		*root;			/* Root node */
-  size_t	num_references;		/* Number of references */
+  mmd_option_t	options;		/* Markdown options */
+  _mmd_arena_t	*arena,			/* Memory arena of root node */
+		*refarena;		/* Memory arena for references */
+  mmd_event_cb_t cb;			/* Event callback, if any */
+  void		*cbdata;		/* Event callback data */
+  char		*line;			/* Current line */
+  const char	*linesrc;		/* Source of current line, if resident */
+  size_t	linevalid;		/* Number of bytes matching the source */
+  size_t	num_references,		/* Number of references */
+		alloc_references;	/* Allocated references */
   _mmd_ref_t	*references;		/* References */
+  size_t	refhashsize,		/* Size of reference hash table */
+		*refhash;		/* Hash table of reference indices + 1 */
+  size_t	num_pending,		/* Number of links waiting for references */
+		alloc_pending;		/* Allocated links */
+  _mmd_pending_t *pending;		/* Links waiting for references */
+  _mmd_refops_t	*refops;		/* Log of reference operations, if deferred */
 } _mmd_doc_t;
 
+typedef struct _mmd_job_s		/**** Deferred inline parsing ****/
+{
+  mmd_t		*parent,		/* Leaf block */
+		*after,			/* Child to add nodes after, if any */
+		*first,			/* First node parsed */
+		*last;			/* Last node parsed */
+  char		*text;			/* Copy of text to parse */
+  const char	*linesrc;		/* Source of text, if resident */
+  size_t	linevalid;		/* Number of bytes matching the source */
+  int		state;			/* MMD_JOB_ state */
+  _mmd_refops_t	*refops;		/* Log of reference operations */
+  size_t	firstop,		/* First reference operation in log */
+		num_ops;		/* Number of reference operations */
+} _mmd_job_t;
+
+typedef struct _mmd_find_s		/**** Look-ahead for a delimiter ****/
+{
+  const char	*start,			/* Start of last search */
+		*found;			/* Delimiter found by last search */
+} _mmd_find_t;
+
 typedef struct _mmd_stack_s		/**** Markdown block stack ****/
 {
   mmd_t		*parent;		/* Parent node */
@@ -121,6 +272,66 @@ typedef struct _mmd_stack_s		/**** Markdown block stack ****/
   size_t	fencelen;		/* Length of code fence */
 } _mmd_stack_t;
 
+struct _mmd_parser_s			/**** Markdown parser ****/
+{
+  _mmd_doc_t	doc;			/* Document */
+  _mmd_filebuf_t file;			/* Input buffer */
+  int		created,		/* Did the parser create the document? */
+		finished;		/* Has the document been finished? */
+  mmd_t		*block;			/* Current block */
+  char		*pending;		/* Text of block waiting for continuation lines */
+  int		metadata;		/* In document metadata? */
+  int		blank_code;		/* Saved indented blank code line */
+  mmd_type_t	columns[256];		/* Alignment of table columns */
+  int		num_columns,		/* Number of columns in table */
+		rows;			/* Number of rows in table */
+  _mmd_stack_t	stack[32],		/* Block stack */
+		*stackptr;		/* Pointer to top of stack */
+  char		*line;			/* Current line */
+  size_t	linelen,		/* Length of text in line buffer */
+		linesize;		/* Size of line buffer */
+  char		*carry;			/* Text carried over to the next chunk */
+  size_t	carrylen,		/* Length of carried over text */
+		carrysize;		/* Size of carry buffer */
+  _mmd_arena_t	refarena;		/* Memory for references when streaming */
+  size_t	num_jobs,		/* Number of inline parsing jobs */
+		alloc_jobs;		/* Allocated inline parsing jobs */
+  _mmd_job_t	*jobs;			/* Inline parsing jobs */
+  _mmd_arena_t	jobarena;		/* Memory for text of inline parsing jobs */
+  _mmd_refops_t	refops;			/* Reference operations of jobs parsed right away */
+};
+
+typedef struct _mmd_pool_s		/**** Pool of inline parsing threads ****/
+{
+  mmd_parser_t	*parser;		/* Parser */
+  size_t	nextjob;		/* Next job to claim */
+#ifdef MMD_HAVE_THREADS
+  pthread_mutex_t mutex;		/* Mutex for next job */
+#endif /* MMD_HAVE_THREADS */
+} _mmd_pool_t;
+
+typedef struct _mmd_section_s		/**** Section of a document parsed on its own thread ****/
+{
+  mmd_parser_t	*parser;		/* Parser for section */
+  char		*start,			/* Start of section */
+		*end;			/* End of section */
+  int		resident;		/* Section is kept with the document? */
+#ifdef MMD_HAVE_THREADS
+  int		threaded;		/* Is a thread parsing the section? */
+  pthread_t	thread;			/* Thread */
+#endif /* MMD_HAVE_THREADS */
+} _mmd_section_t;
+
+typedef struct _mmd_worker_s		/**** Inline parsing thread ****/
+{
+  _mmd_pool_t	*pool;			/* Pool of threads */
+  _mmd_arena_t	arena;			/* Memory for nodes */
+  _mmd_refops_t	refops;			/* Log of reference operations */
+#ifdef MMD_HAVE_THREADS
+  pthread_t	thread;			/* Thread */
+#endif /* MMD_HAVE_THREADS */
+} _mmd_worker_t;
+
 
 /*
  * Local globals...
@@ -129,24 +340,92 @@ typedef struct _mmd_stack_s		/**** Markdown block stack ****/
 static mmd_option_t	mmd_options = MMD_OPTION_ALL;
 					/* Markdown extensions to support */
 
+static const unsigned char mmd_chars[256] =
+{					/* Character classes */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x63, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,	/* 0x00 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x10 */
+  0x63, 0x88, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x98, 0x18, 0x08, 0x38, 0x08, 0x08,	/* 0x20 */
+  0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x28, 0x08, 0x88, 0x08, 0x48, 0x08,	/* 0x30 */
+  0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x40 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x88, 0x08, 0x08, 0x08, 0x88,	/* 0x50 */
+  0x88, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x60 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x28, 0x08, 0x88, 0x00,	/* 0x70 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x80 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x90 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xA0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xB0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xC0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xD0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xE0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00	/* 0xF0 */
+};
+
+static const unsigned char mmd_blocks[256] =
+{					/* Block markup each character can start */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x00 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x10 */
+  0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x08, 0x00, 0x0e, 0x00, 0x00,	/* 0x20 */
+  0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00,	/* 0x30 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x40 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,	/* 0x50 */
+  0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x60 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,	/* 0x70 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x80 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0x90 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xA0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xB0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xC0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xD0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	/* 0xE0 */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00	/* 0xF0 */
+};
+
 
 /*
  * Local functions...
  */
 
-static mmd_t	*mmd_add(mmd_t *parent, mmd_type_t type, int whitespace, char *text, char *url);
-static void	mmd_free(mmd_t *node);
+static mmd_t	*mmd_add(_mmd_doc_t *doc, mmd_t *parent, mmd_type_t type, int whitespace, char *text, char *url);
+static _mmd_arena_t *mmd_arena(mmd_t *node);
+static void	*mmd_arena_alloc(_mmd_arena_t *arena, size_t bytes);
+static void	mmd_arena_free(_mmd_arena_t *arena);
+static void	mmd_arena_merge(_mmd_arena_t *arena, _mmd_arena_t *from);
+static void	mmd_arena_reset(_mmd_arena_t *arena);
+static char	*mmd_arena_read(_mmd_arena_t *arena, FILE *fp, size_t *bytes);
+static char	*mmd_arena_strdup(_mmd_arena_t *arena, const char *s);
+static void	mmd_emit(_mmd_doc_t *doc, mmd_t *node);
 static int	mmd_has_continuation(const char *line, _mmd_filebuf_t *file, int indent);
-static size_t	mmd_is_chars(const char *lineptr, const char *chars, size_t minchars);
+static int	mmd_has_lines(_mmd_filebuf_t *file);
+static size_t	mmd_is_chars(const char *lineptr, int ch, size_t minchars);
 static size_t	mmd_is_codefence(char *lineptr, char fence, size_t fencelen, char **language);
 static int	mmd_is_table(_mmd_filebuf_t *file, int indent);
-static void	mmd_parse_inline(_mmd_doc_t *doc, mmd_t *parent, char *lineptr);
+static int	mmd_is_top_level(mmd_parser_t *parser);
+static _mmd_line_t *mmd_next_line(_mmd_filebuf_t *file);
+static const char *mmd_parse_find(_mmd_find_t *finds, const char *lineptr, const char *delim);
+static void	mmd_parse_inline(_mmd_doc_t *doc, mmd_t *parent, int whitespace, char *lineptr);
+static void	mmd_parse_job(mmd_parser_t *parser, _mmd_job_t *job, mmd_t *parent, int whitespace, _mmd_arena_t *arena, _mmd_refops_t *refops);
+static void	mmd_parse_jobs(mmd_parser_t *parser);
+static void	mmd_parse_line(mmd_parser_t *parser);
+static void	mmd_parse_lines(mmd_parser_t *parser, int finish);
 static char	*mmd_parse_link(_mmd_doc_t *doc, char *lineptr, char **text, char **url, char **title, char **refname);
-static void	mmd_read_buffer(_mmd_filebuf_t *file);
-static char	*mmd_read_line(_mmd_filebuf_t *file, char *line, size_t linesize);
+static void	mmd_parse_pending(mmd_parser_t *parser);
+static int	mmd_parse_queue(mmd_parser_t *parser, mmd_t *parent, char *text);
+static void	*mmd_parse_section(_mmd_section_t *section);
+static void	mmd_parse_sections(mmd_parser_t *parser, char *data, size_t datalen, int resident);
+static void	*mmd_parse_worker(_mmd_worker_t *worker);
+static int	mmd_parser_carry(mmd_parser_t *parser, const char *data, size_t datalen);
+static int	mmd_parser_feed(mmd_parser_t *parser, const char *data, size_t datalen, int resident);
+static void	mmd_parser_flush(mmd_parser_t *parser);
+static int	mmd_parser_grow(mmd_parser_t *parser, size_t linesize);
+static int	mmd_parser_start(mmd_parser_t *parser, mmd_t *root);
+static char	*mmd_read_line(mmd_parser_t *parser, size_t offset);
+static const char *mmd_read_span(const char *ptr, const char *end);
 static void	mmd_ref_add(_mmd_doc_t *doc, mmd_t *node, const char *name, const char *url, const char *title);
+static void	mmd_ref_clear(_mmd_doc_t *doc);
 static _mmd_ref_t *mmd_ref_find(_mmd_doc_t *doc, const char *name);
+static size_t	mmd_ref_hash(const char *name);
 static void	mmd_remove(mmd_t *node);
+static _mmd_line_t *mmd_scan_line(_mmd_line_t *rec, const char *start, char *end);
 #if DEBUG
 static const char *mmd_type_string(mmd_type_t type);
 #endif /* DEBUG */
@@ -172,7 +451,7 @@ mmdCopyAllText(mmd_t *node)		/* I - Parent node */
 
   current = mmdGetFirstChild(node);
 
-  while (current != node)
+  while (current && current != node)
   {
     if (current->text)
     {
@@ -180,9 +459,9 @@ mmdCopyAllText(mmd_t *node)		/* I - Parent node */
       * Append this node's text to the string...
       */
 
-      textlen = strlen(current->text);
+      textlen = current->textlen;
       allsize += textlen + (size_t)current->whitespace;
-      temp    = realloc(all, allsize);
+      temp    = realloc(all, allsize + 1);
 
       if (!temp)
       {
@@ -227,55 +506,26 @@ mmdCopyAllText(mmd_t *node)		/* I - Parent node */
 
 /*
  * 'mmdFree()' - Free a markdown tree.
+ *
+ * All nodes and text in a document are allocated from a memory arena owned by
+ * the document root, so freeing the root releases everything at once.  Freeing
+ * any other node just removes it from the document - the memory it uses is
+ * released when the document is freed.
  */
 
 void
 mmdFree(mmd_t *node)			/* I - First node */
 {
-  mmd_t *current,			/* Current node */
-	*next;				/* Next node */
-
+  if (!node)
+    return;
 
   mmd_remove(node);
 
-  for (current = node->first_child; current; current = next)
+  if (node->type == MMD_TYPE_DOCUMENT)
   {
-   /*
-    * Get the next node...
-    */
-
-    if ((next = current->first_child) != NULL)
-    {
-     /*
-      * Free parent nodes after child nodes have been freed...
-      */
-
-      current->first_child = NULL;
-      continue;
-    }
-
-    if ((next = current->next_sibling) == NULL)
-    {
-     /*
-      * Next node is the parent, which we'll free as needed...
-      */
-
-      if ((next = current->parent) == node)
-	next = NULL;
-    }
-
-   /*
-    * Free child...
-    */
-
-    mmd_free(current);
+    mmd_arena_free(&((_mmd_root_t *)node)->arena);
+    free(node);
   }
-
- /*
-  * Then free the memory used by the parent node...
-  */
-
-  mmd_free(node);
 }
 
 
@@ -336,11 +586,11 @@ mmdGetMetadata(mmd_t	  *doc,		/* I - Document */
 
   for (current = metadata->first_child; current; current = current->next_sibling)
   {
-    if (strncmp(current->text, prefix, prefix_len))
+    if ((value = mmdGetText(current)) == NULL || strncmp(value, prefix, prefix_len))
       continue;
 
-    value = current->text + prefix_len;
-    while (isspace(*value & 255))
+    value += prefix_len;
+    while (mmd_isspace(*value))
       value ++;
 
     return (value);
@@ -363,6 +613,8 @@ mmdGetNextSibling(mmd_t *node)		/* I - Node */
 
 /*
  * 'mmdGetOptions()' - Get the enabled markdown processing options/extensions.
+ *
+ * These are the options set with @link mmdSetOptions@.
  */
 
 mmd_option_t				/* O - Enabled options */
@@ -396,12 +648,60 @@ mmdGetPrevSibling(mmd_t *node)		/* I - Node */
 
 /*
  * 'mmdGetText()' - Return the text associated with a node, if any.
+ *
+ * Text that references the document source (`MMD_OPTION_SPANS`) is copied to a
+ * nul-terminated string the first time it is requested.
  */
 
 const char *				/* O - Text or @code NULL@ if none */
 mmdGetText(mmd_t *node)			/* I - Node */
 {
-  return (node ? node->text : NULL);
+  _mmd_arena_t	*arena;			/* Memory arena for node */
+  char		*text;			/* Copy of text */
+
+
+  if (!node)
+    return (NULL);
+
+  if (node->span)
+  {
+    if ((arena = mmd_arena(node)) == NULL || (text = mmd_arena_alloc(arena, node->textlen + 1)) == NULL)
+      return (NULL);
+
+    memcpy(text, node->text, node->textlen);
+    text[node->textlen] = '\0';
+
+    node->text = text;
+    node->span = 0;
+  }
+
+  return (node->text);
+}
+
+
+/*
+ * 'mmdGetTextSpan()' - Return the text associated with a node and its length.
+ *
+ * Unlike @link mmdGetText@, the returned text is not nul-terminated when it
+ * references the document source (`MMD_OPTION_SPANS`).
+ */
+
+const char *				/* O - Text or @code NULL@ if none */
+mmdGetTextSpan(mmd_t  *node,		/* I - Node */
+               size_t *len)		/* O - Length of text */
+{
+  if (!node || !node->text)
+  {
+    if (len)
+      *len = 0;
+
+    return (NULL);
+  }
+
+  if (len)
+    *len = node->textlen;
+
+  return (node->text);
 }
 
 
@@ -456,18 +756,129 @@ mmdIsBlock(mmd_t *node)			/* I - Node */
 mmd_t *					/* O - Root node in markdown */
 mmdLoad(mmd_t      *root,		/* I - Root node for document or `NULL` for a new document */
         const char *filename)		/* I - File to load */
+{
+  return (mmdLoadEx(root, filename, mmd_options));
+}
+
+
+/*
+ * 'mmdLoadBuffer()' - Load a markdown buffer into nodes.
+ *
+ * The buffer does not need to be nul-terminated and is not used after this
+ * function returns.
+ */
+
+mmd_t *					/* O - Root node in markdown */
+mmdLoadBuffer(mmd_t      *root,		/* I - Root node for document or `NULL` for a new document */
+              const char *data,		/* I - Markdown text */
+              size_t     datalen)	/* I - Length of markdown text in bytes */
+{
+  return (mmdLoadBufferEx(root, data, datalen, mmd_options));
+}
+
+
+/*
+ * 'mmdLoadBufferEx()' - Load a markdown buffer into nodes with the specified
+ *                       options.
+ *
+ * The buffer does not need to be nul-terminated and is not used after this
+ * function returns.  Large buffers are parsed in sections using multiple
+ * threads when the `MMD_OPTION_THREADS` option is set.
+ */
+
+mmd_t *					/* O - Root node in markdown */
+mmdLoadBufferEx(mmd_t        *root,	/* I - Root node for document or `NULL` for a new document */
+                const char   *data,	/* I - Markdown text */
+                size_t       datalen,	/* I - Length of markdown text in bytes */
+                mmd_option_t options)	/* I - Markdown options */
+{
+  mmd_parser_t	*parser;		/* Parser */
+  char		*copy;			/* Copy of markdown text */
+
+
+  if ((parser = mmdParserNewEx(root, options)) == NULL)
+    return (NULL);
+
+  if ((options & MMD_OPTION_THREADS) && datalen >= 2 * MMD_SECTION_MIN)
+  {
+    if (!(options & MMD_OPTION_SPANS))
+      mmd_parse_sections(parser, (char *)data, datalen, 0);
+    else if ((copy = mmd_arena_alloc(parser->doc.arena, datalen + 1)) != NULL)
+    {
+      memcpy(copy, data, datalen);
+      copy[datalen] = '\0';
+
+      mmd_parse_sections(parser, copy, datalen, 1);
+    }
+  }
+  else
+    mmdParserFeed(parser, data, datalen);
+
+  root = mmdParserFinish(parser);
+
+  mmdParserDelete(parser);
+
+  return (root);
+}
+
+
+/*
+ * 'mmdLoadEx()' - Load a markdown file into nodes with the specified options.
+ */
+
+mmd_t *					/* O - Root node in markdown */
+mmdLoadEx(mmd_t        *root,		/* I - Root node for document or `NULL` for a new document */
+          const char   *filename,	/* I - File to load */
+          mmd_option_t options)		/* I - Markdown options */
 {
   FILE		*fp;			/* File */
+#ifndef _WIN32
+  int		fd;			/* File descriptor */
+  struct stat	fileinfo;		/* File information */
+  void		*data;			/* Mapped file */
+
+
+ /*
+  * Map large regular files into memory and parse them in place...
+  */
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (NULL);
+
+  if (!fstat(fd, &fileinfo) && S_ISREG(fileinfo.st_mode) && fileinfo.st_size >= MMD_MAP_MIN && (off_t)(size_t)fileinfo.st_size == fileinfo.st_size && (data = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+  {
+#  ifdef MADV_SEQUENTIAL
+    madvise(data, (size_t)fileinfo.st_size, MADV_SEQUENTIAL);
+#  endif /* MADV_SEQUENTIAL */
+
+    root = mmdLoadBufferEx(root, data, (size_t)fileinfo.st_size, options);
 
+    munmap(data, (size_t)fileinfo.st_size);
+    close(fd);
 
+    return (root);
+  }
+
+ /*
+  * Otherwise use stdio to read the file...
+  */
+
+  if ((fp = fdopen(fd, "r")) == NULL)
+  {
+    close(fd);
+    return (NULL);
+  }
+
+#else
  /*
   * Open the file and load the document...
   */
 
   if ((fp = fopen(filename, "r")) == NULL)
     return (NULL);
+#endif /* !_WIN32 */
 
-  root = mmdLoadFile(root, fp);
+  root = mmdLoadFileEx(root, fp, options);
 
  /*
   * Close and return...
@@ -484,852 +895,812 @@ mmdLoad(mmd_t      *root,		/* I - Root node for document or `NULL` for a new doc
  */
 
 mmd_t *					/* O - First node in markdown */
-mmdLoadFile(mmd_t *root,
+mmdLoadFile(mmd_t *root,		/* I - Root node for document or `NULL` for a new document */
             FILE  *fp)			/* I - File to load */
 {
-  size_t	i;			/* Looping var */
-  _mmd_doc_t	doc;			/* Document */
-  _mmd_ref_t	*reference;		/* Current reference */
-  mmd_t		*block = NULL;		/* Current block */
-  mmd_type_t	type;			/* Type for line */
-  _mmd_filebuf_t file;			/* File buffer */
-  char		line[8192],		/* Read line */
-		*linestart,		/* Start of line */
-		*lineptr,		/* Pointer into line */
-		*lineend,		/* End of line */
-		*temp;			/* Temporary pointer */
-  int		newindent;		/* New indentation */
-  int		blank_code = 0;		/* Saved indented blank code line */
-  mmd_type_t	columns[256];		/* Alignment of table columns */
-  int		num_columns = 0,	/* Number of columns in table */
-		rows = 0;		/* Number of rows in table */
-  _mmd_stack_t	stack[32],		/* Block stack */
-		*stackptr = stack;	/* Pointer to top of stack */
-
+  return (mmdLoadFileEx(root, fp, mmd_options));
+}
 
- /*
-  * Create an empty document as needed...
-  */
 
-  DEBUG_printf("mmdLoadFile: mmd_options=%d%s%s\n", mmd_options, (mmd_options & MMD_OPTION_METADATA) ? " METADATA" : "", (mmd_options & MMD_OPTION_TABLES) ? " TABLES" : "");
+/*
+ * 'mmdLoadFileEx()' - Load a markdown file into nodes from a stdio file with
+ *                     the specified options.
+ */
 
-  memset(&doc, 0, sizeof(doc));
+mmd_t *					/* O - First node in markdown */
+mmdLoadFileEx(mmd_t        *root,	/* I - Root node for document or `NULL` for a new document */
+              FILE         *fp,		/* I - File to load */
+              mmd_option_t options)	/* I - Markdown options */
+{
+  mmd_parser_t	*parser;		/* Parser */
+  char		*buffer;		/* Read buffer */
+  size_t	bytes;			/* Bytes read */
 
-  if (root)
-    doc.root = root;
-  else
-    doc.root = mmd_add(NULL, MMD_TYPE_DOCUMENT, 0, NULL, NULL);
 
-  if (!doc.root)
+  if ((parser = mmdParserNewEx(root, options)) == NULL)
     return (NULL);
 
- /*
-  * Initialize the block stack...
-  */
+  if (options & MMD_OPTION_SPANS)
+  {
+   /*
+    * Keep the whole file in the document so text nodes can reference it...
+    */
 
-  memset(stack, 0, sizeof(stack));
-  stackptr->parent = doc.root;
+    if ((buffer = mmd_arena_read(parser->doc.arena, fp, &bytes)) != NULL)
+    {
+      if (options & MMD_OPTION_THREADS)
+        mmd_parse_sections(parser, buffer, bytes, 1);
+      else
+	mmd_parser_feed(parser, buffer, bytes, 1);
+    }
+  }
+  else if ((buffer = malloc(MMD_BUFFER_SIZE)) != NULL)
+  {
+   /*
+    * Feed the file to the parser one buffer at a time...
+    */
 
- /*
-  * Read lines until end-of-file...
-  */
+    while ((bytes = fread(buffer, 1, MMD_BUFFER_SIZE, fp)) > 0)
+      mmd_parser_feed(parser, buffer, bytes, 0);
 
-  memset(&file, 0, sizeof(file));
-  file.fp = fp;
+    free(buffer);
+  }
 
-#ifdef __clang_analyzer__
-  memset(line, 0, sizeof(line));
-#endif // __clang_analyzer__
+  root = mmdParserFinish(parser);
 
-  while ((lineptr = mmd_read_line(&file, line, sizeof(line))) != NULL)
-  {
-    DEBUG_printf("%03d	%-12s  %s", stackptr->indent, mmd_type_string(stackptr->parent->type) + 9, lineptr);
-#if DEBUG
-    if (stackptr->parent->type == MMD_TYPE_CODE_BLOCK)
-      DEBUG2_printf("	  blank_code=%d\n", blank_code);
-#endif /* DEBUG */
+  mmdParserDelete(parser);
 
-    linestart = lineptr;
+  return (root);
+}
 
-    while (isspace(*lineptr & 255))
-      lineptr ++;
 
-    DEBUG2_printf("	line indent=%d\n", (int)(lineptr - line));
-    DEBUG2_printf("	stackptr=%d\n", (int)(stackptr - stack));
+/*
+ * 'mmdLoadString()' - Load a markdown string into nodes.
+ */
 
-    if (*lineptr == '>' && (lineptr - linestart) < 4)
-    {
-     /*
-      * Block quote.  See if there is an existing blockquote...
-      */
+mmd_t *					/* O - Root node in markdown */
+mmdLoadString(mmd_t      *root,		/* I - Root node for document or `NULL` for a new document */
+              const char *s)		/* I - String to load */
+{
+  return (mmdLoadBuffer(root, s, strlen(s)));
+}
 
-      DEBUG_printf("	 BLOCKQUOTE (stackptr=%ld)\n", stackptr - stack);
 
-      if (stackptr == stack || stack[1].parent->type != MMD_TYPE_BLOCK_QUOTE)
-      {
-	block		 = NULL;
-	stackptr	 = stack + 1;
-	stackptr->parent = mmd_add(doc.root, MMD_TYPE_BLOCK_QUOTE, 0, NULL, NULL);
-	stackptr->indent = 2;
-	stackptr->fence	 = '\0';
-      }
+/*
+ * 'mmdLoadStringEx()' - Load a markdown string into nodes with the specified
+ *                       options.
+ */
 
-     /*
-      * Skip whitespace after the ">"...
-      */
+mmd_t *					/* O - Root node in markdown */
+mmdLoadStringEx(mmd_t        *root,	/* I - Root node for document or `NULL` for a new document */
+                const char   *s,	/* I - String to load */
+                mmd_option_t options)	/* I - Markdown options */
+{
+  return (mmdLoadBufferEx(root, s, strlen(s), options));
+}
 
-      lineptr ++;
-      if (isspace(*lineptr & 255))
-	lineptr ++;
 
-      linestart = lineptr;
+/*
+ * 'mmdParserDelete()' - Free a markdown parser.
+ *
+ * If @link mmdParserFinish@ has not been called, the partial document is also
+ * freed when the parser created it.
+ */
 
-      while (isspace(*lineptr & 255))
-	lineptr ++;
-    }
-    else if (*lineptr != '>' && stackptr > stack && stack[1].parent->type == MMD_TYPE_BLOCK_QUOTE && (!block || *lineptr == '\n' || mmd_is_chars(lineptr, "- \t", 3) || mmd_is_chars(lineptr, "_ \t", 3) || mmd_is_chars(lineptr, "* \t", 3)))
-    {
-     /*
-      * Not a lazy continuation so terminate this block quote...
-      */
+void
+mmdParserDelete(mmd_parser_t *parser)	/* I - Parser */
+{
+  if (!parser)
+    return;
 
-      DEBUG_puts("     Terminating BLOCKQUOTE\n");
-      block    = NULL;
-      stackptr = stack;
-    }
+  mmd_ref_clear(&parser->doc);
 
-   /*
-    * Now handle all other markup not related to block quotes...
-    */
+  if (!parser->finished && parser->created)
+    mmdFree(parser->doc.root);
 
-    DEBUG2_printf("	stackptr=%d (%s), block=%p (%s)\n", (int)(stackptr - stack), mmd_type_string(stackptr->parent->type) + 9, block, block ? mmd_type_string(block->type) + 9 : "");
-    DEBUG2_printf("	strchr(lineptr, '|')=%p, mmd_is_table(&file, stackptr->indent)=%d\n", strchr(lineptr, '|'), mmd_is_table(&file, stackptr->indent));
-    DEBUG2_printf("	linestart=%d, lineptr=%d\n", (int)(linestart - line), (int)(lineptr - line));
-    DEBUG2_printf("	mmd_is_chars(lineptr, \"-\", 1)=%d\n", (int)mmd_is_chars(lineptr, "-", 1));
-    DEBUG2_printf("	mmd_is_chars(lineptr, \"=\", 1)=%d\n", (int)mmd_is_chars(lineptr, "=", 1));
+  free(parser->doc.references);
+  free(parser->doc.refhash);
+  free(parser->doc.pending);
 
-    if ((lineptr - line - stackptr->indent) < 4 && ((stackptr->parent->type != MMD_TYPE_CODE_BLOCK && !stackptr->fence && mmd_is_codefence(lineptr, '\0', 0, NULL)) || (stackptr->fence && mmd_is_codefence(lineptr, stackptr->fence, stackptr->fencelen, NULL))))
-    {
-     /*
-      * Code fence...
-      */
+  mmd_arena_free(&parser->refarena);
+  mmd_arena_free(&parser->jobarena);
 
-      DEBUG2_printf("stackptr->indent=%d, fence='%c', fencelen=%d\n", stackptr->indent, stackptr->fence, (int)stackptr->fencelen);
+  free(parser->jobs);
+  free(parser->refops.ops);
+  free(parser->carry);
+  free(parser->line);
+  free(parser);
+}
 
-      if (stackptr->parent->type == MMD_TYPE_CODE_BLOCK)
-      {
-	DEBUG2_puts("Ending code block...\n");
-	stackptr --;
-      }
-      else if (stackptr < (stack + sizeof(stack) / sizeof(stack[0]) - 1))
-      {
-	char	*language;		/* Language name, if any */
 
-	DEBUG2_printf("Starting code block with fence '%c'.\n", *lineptr);
+/*
+ * 'mmdParserFeed()' - Parse the next chunk of markdown text.
+ *
+ * Complete lines are parsed as soon as the following line is available, and
+ * any remaining text is kept for the next call, so chunks can be split at any
+ * byte.  The data is not used after this function returns.
+ */
 
-	block		     = NULL;
-	stackptr[1].parent   = mmd_add(stackptr->parent, MMD_TYPE_CODE_BLOCK, 0, NULL, NULL);
-	stackptr[1].indent   = lineptr - line;
-	stackptr[1].fence    = *lineptr;
-	stackptr[1].fencelen = mmd_is_codefence(lineptr, '\0', 0, &language);
-	stackptr ++;
+int					/* O - 1 on success, 0 on error */
+mmdParserFeed(mmd_parser_t *parser,	/* I - Parser */
+              const char   *data,	/* I - Markdown text */
+              size_t       datalen)	/* I - Length of markdown text in bytes */
+{
+  char		*copy;			/* Copy of markdown text */
 
-	DEBUG2_printf("Code language=\"%s\"\n", language);
 
-	if (language)
-	  stackptr->parent->extra = strdup(language);
+  if (!parser || parser->finished || (!data && datalen > 0))
+    return (0);
+  else if (!datalen)
+    return (1);
 
-	blank_code = 0;
-      }
-      continue;
-    }
-    else if (stackptr->parent->type == MMD_TYPE_CODE_BLOCK && (lineptr - line) >= stackptr->indent)
-    {
-      if (line[stackptr->indent] == '\n')
-      {
-	blank_code ++;
-      }
-      else
-      {
-	while (blank_code > 0)
-	{
-	  mmd_add(stackptr->parent, MMD_TYPE_CODE_TEXT, 0, "\n", NULL);
-	  blank_code --;
-	}
+  if ((parser->doc.options & MMD_OPTION_SPANS) && !parser->doc.cb)
+  {
+   /*
+    * Keep the text in the document so text nodes can reference it...
+    */
 
-	mmd_add(stackptr->parent, MMD_TYPE_CODE_TEXT, 0, line + stackptr->indent, NULL);
-      }
-      continue;
-    }
-    else if (stackptr->parent->type == MMD_TYPE_CODE_BLOCK && stackptr->fence)
-    {
-      DEBUG2_printf("	  fence='%c'\n", stackptr->fence);
+    if ((copy = mmd_arena_alloc(parser->doc.arena, datalen + 1)) == NULL)
+      return (0);
 
-      if (!*lineptr)
-      {
-	blank_code ++;
-      }
-      else
-      {
-	while (blank_code > 0)
-	{
-	  mmd_add(stackptr->parent, MMD_TYPE_CODE_TEXT, 0, "\n", NULL);
-	  blank_code --;
-	}
+    memcpy(copy, data, datalen);
+    copy[datalen] = '\0';
 
-	mmd_add(stackptr->parent, MMD_TYPE_CODE_TEXT, 0, lineptr, NULL);
-      }
-      continue;
-    }
-    else if (!strncmp(lineptr, "---", 3) && doc.root->first_child == NULL && (mmd_options & MMD_OPTION_METADATA))
-    {
-     /*
-      * Document metadata...
-      */
+    return (mmd_parser_feed(parser, copy, datalen, 1));
+  }
+  else
+    return (mmd_parser_feed(parser, data, datalen, 0));
+}
 
-      block = mmd_add(doc.root, MMD_TYPE_METADATA, 0, NULL, NULL);
 
-      while ((lineptr = mmd_read_line(&file, line, sizeof(line))) != NULL)
-      {
-	while (isspace(*lineptr & 255))
-	  lineptr ++;
+/*
+ * 'mmdParserFinish()' - Finish parsing and return the document.
+ *
+ * The remaining text is parsed and any undefined reference links are
+ * converted to plain text.  The document is owned by the caller and must be
+ * freed using @link mmdFree@.
+ */
 
-	if (!strncmp(lineptr, "---", 3) || !strncmp(lineptr, "...", 3))
-	  break;
+mmd_t *					/* O - Root node in markdown or `NULL` on error */
+mmdParserFinish(mmd_parser_t *parser)	/* I - Parser */
+{
+  size_t	i;			/* Looping var */
+  _mmd_doc_t	*doc;			/* Document */
+  _mmd_ref_t	*reference;		/* Current reference */
+  _mmd_pending_t *pending;		/* Current link waiting for a reference */
 
-	lineend = lineptr + strlen(lineptr) - 1;
-	if (lineend > lineptr && *lineend == '\n')
-	  *lineend = '\0';
 
-	mmd_add(block, MMD_TYPE_METADATA_TEXT, 0, lineptr, NULL);
-      }
-      continue;
-    }
-    else if (block && block->type == MMD_TYPE_PARAGRAPH && (lineptr - linestart) < 4 && (lineptr - line) >= stackptr->indent && (mmd_is_chars(lineptr, "-", 1) || mmd_is_chars(lineptr, "=", 1)))
-    {
-      int ch = *lineptr;
+  if (!parser || parser->finished)
+    return (NULL);
 
-      DEBUG_puts("     SETEXT HEADING\n");
+ /*
+  * Parse any remaining lines...
+  */
 
-      lineptr += 3;
-      while (*lineptr == ch)
-	lineptr ++;
-      while (isspace(*lineptr & 255))
-	lineptr ++;
+  mmd_parser_flush(parser);
 
-      if (!*lineptr)
-      {
-	if (ch == '=')
-	  block->type = MMD_TYPE_HEADING_1;
-	else
-	  block->type = MMD_TYPE_HEADING_2;
+  if (parser->num_jobs)
+    mmd_parse_jobs(parser);
 
-	block = NULL;
-	continue;
-      }
+  parser->finished = 1;
 
-      type = MMD_TYPE_PARAGRAPH;
-    }
-    else if ((lineptr - linestart) < 4 && (mmd_is_chars(lineptr, "- \t", 3) || mmd_is_chars(lineptr, "_ \t", 3) || mmd_is_chars(lineptr, "* \t", 3)))
+  if (parser->doc.cb)
+  {
+   /*
+    * Send the last block and the end of the document to the callback...
+    */
+
+    mmd_t	*last = parser->doc.root->last_child;
+					/* Last top-level block */
+
+    if (last)
     {
-      DEBUG_puts("     THEMATIC BREAK\n");
+      mmd_emit(&parser->doc, last);
+      mmd_remove(last);
+      mmd_arena_reset(parser->doc.arena);
+    }
 
-      if (line[0] == '>')
-	stackptr = stack + 1;
-      else
-	stackptr = stack;
+    (parser->doc.cb)(parser->doc.cbdata, parser->doc.root, MMD_EVENT_LEAVE_BLOCK);
+  }
+
+ /*
+  * Resolve links to references that were defined later in the document, and
+  * show any links to undefined references as "[name]"...
+  */
+
+  doc = &parser->doc;
+
+  for (i = doc->num_pending, pending = doc->pending; i > 0; i --, pending ++)
+  {
+    mmd_t	*node = pending->node;	/* Link node */
+    size_t	namelen;		/* Length of reference name */
 
-      mmd_add(stackptr->parent, MMD_TYPE_THEMATIC_BREAK, 0, NULL, NULL);
-//      type  = MMD_TYPE_PARAGRAPH;
-      block = NULL;
+    reference = doc->references + pending->ref;
+
+    if (reference->url)
+    {
+      node->url   = reference->url;
+      node->extra = reference->title;
       continue;
     }
-    else if ((*lineptr == '-' || *lineptr == '+' || *lineptr == '*') && (lineptr[1] == '\t' || lineptr[1] == ' '))
-    {
-     /*
-      * Bulleted list...
-      */
-
-      DEBUG_puts("     UNORDERED LIST\n");
 
-      lineptr	+= 2;
-      linestart = lineptr;
-      newindent = linestart - line;
+    DEBUG2_printf("Clearing link for '%s'.\n", reference->name);
 
-      while (isspace(*lineptr & 255))
-	lineptr ++;
+    namelen = strlen(reference->name);
 
-      while (stackptr > stack && stackptr->indent > newindent)
-	stackptr --;
+    if ((node->text = mmd_arena_alloc(doc->arena, namelen + 3)) != NULL)
+    {
+      node->text[0] = '[';
+      memcpy(node->text + 1, reference->name, namelen);
+      node->text[namelen + 1] = ']';
+      node->text[namelen + 2] = '\0';
+      node->textlen           = namelen + 2;
+    }
+    else
+      node->textlen = 0;
 
-      if (stackptr > stack && stackptr->parent->type == MMD_TYPE_LIST_ITEM && stackptr->indent == newindent)
-	stackptr --;
+    node->span = 0;
+    node->type = MMD_TYPE_NORMAL_TEXT;
+  }
 
-      if (stackptr > stack && stackptr->parent->type == MMD_TYPE_ORDERED_LIST && stackptr->indent == newindent)
-	stackptr --;
+ /*
+  * Clear the references, keeping the memory in case the parser is reused...
+  */
 
-      if (stackptr > stack && stackptr->parent->type == MMD_TYPE_BLOCK_QUOTE && line[0] != '>')
-	stackptr --;
+  mmd_ref_clear(doc);
 
-      if (stackptr->parent->type != MMD_TYPE_UNORDERED_LIST && stackptr < (stack + sizeof(stack) / sizeof(stack[0]) - 1))
-      {
-	stackptr[1].parent = mmd_add(stackptr->parent, MMD_TYPE_UNORDERED_LIST, 0, NULL, NULL);
-	stackptr[1].indent = linestart - line;
-	stackptr[1].fence  = '\0';
-	stackptr ++;
-      }
+ /*
+  * Return the root node...
+  */
 
-      if (stackptr < (stack + sizeof(stack) / sizeof(stack[0]) - 1))
-      {
-	stackptr[1].parent = mmd_add(stackptr->parent, MMD_TYPE_LIST_ITEM, 0, NULL, NULL);
-	stackptr[1].indent = linestart - line;
-	stackptr[1].fence  = '\0';
-	stackptr ++;
-      }
+  return (doc->root);
+}
 
-      type  = MMD_TYPE_PARAGRAPH;
-      block = NULL;
 
-      if (mmd_is_chars(lineptr, "- \t", 3) || mmd_is_chars(lineptr, "_ \t", 3) || mmd_is_chars(lineptr, "* \t", 3))
-      {
-	mmd_add(stackptr->parent, MMD_TYPE_THEMATIC_BREAK, 0, NULL, NULL);
-	continue;
-      }
-    }
-    else if (isdigit(*lineptr & 255))
-    {
-     /*
-      * Ordered list?
-      */
+/*
+ * 'mmdParserNew()' - Create a parser for incremental markdown input.
+ *
+ * Text is passed to the parser using @link mmdParserFeed@ and the document is
+ * completed using @link mmdParserFinish@.  The parser uses the options set
+ * with @link mmdSetOptions@.
+ */
 
-      DEBUG_puts("     ORDERED LIST?\n");
+mmd_parser_t *				/* O - Parser or `NULL` on error */
+mmdParserNew(mmd_t *root)		/* I - Root node for document or `NULL` for a new document */
+{
+  return (mmdParserNewEx(root, mmd_options));
+}
 
-      temp = lineptr + 1;
 
-      while (isdigit(*temp & 255))
-	temp ++;
+/*
+ * 'mmdParserNewEx()' - Create a parser for incremental markdown input with
+ *                      the specified options.
+ *
+ * The options are kept with the parser, so parsers with different options can
+ * be used at the same time from different threads.
+ */
 
-      if ((*temp == '.' || *temp == ')') && (temp[1] == '\t' || temp[1] == ' '))
-      {
-       /*
-	* Yes, ordered list.
-	*/
+mmd_parser_t *				/* O - Parser or `NULL` on error */
+mmdParserNewEx(mmd_t        *root,	/* I - Root node for document or `NULL` for a new document */
+               mmd_option_t options)	/* I - Markdown options */
+{
+  mmd_parser_t	*parser;		/* Parser */
 
-	lineptr	  = temp + 2;
-	linestart = lineptr;
-	newindent = linestart - line;
 
-	while (isspace(*lineptr & 255))
-	  lineptr ++;
+  DEBUG_printf("mmdParserNewEx: options=%d%s%s\n", options, (options & MMD_OPTION_METADATA) ? " METADATA" : "", (options & MMD_OPTION_TABLES) ? " TABLES" : "");
 
-	while (stackptr > stack && stackptr->indent > newindent)
-	  stackptr --;
+  if ((parser = calloc(1, sizeof(mmd_parser_t))) == NULL)
+    return (NULL);
 
-	if (stackptr->parent->type == MMD_TYPE_LIST_ITEM && stackptr->indent == newindent)
-	  stackptr --;
+  parser->doc.options = options;
 
-	if (stackptr->parent->type == MMD_TYPE_UNORDERED_LIST && stackptr->indent == newindent)
-	  stackptr --;
+  if (!mmd_parser_start(parser, root))
+  {
+    free(parser);
+    return (NULL);
+  }
 
-	if (stackptr->parent->type == MMD_TYPE_BLOCK_QUOTE && line[0] != '>')
-	  stackptr --;
+  return (parser);
+}
 
-	if (stackptr->parent->type != MMD_TYPE_ORDERED_LIST && stackptr < (stack + sizeof(stack) / sizeof(stack[0]) - 1))
-	{
-	  stackptr[1].parent = mmd_add(stackptr->parent, MMD_TYPE_ORDERED_LIST, 0, NULL, NULL);
-	  stackptr[1].indent = linestart - line;
-	  stackptr[1].fence  = '\0';
-	  stackptr ++;
-	}
 
-	if (stackptr < (stack + sizeof(stack) / sizeof(stack[0]) - 1))
-	{
-	  stackptr[1].parent = mmd_add(stackptr->parent, MMD_TYPE_LIST_ITEM, 0, NULL, NULL);
-	  stackptr[1].indent = linestart - line;
-	  stackptr[1].fence  = '\0';
-	  stackptr ++;
-	}
+/*
+ * 'mmdParserReset()' - Reset a markdown parser for a new document.
+ *
+ * The parser keeps its line buffers, reference table, and other memory so that
+ * many small documents can be parsed without allocating a new parser for each
+ * one.  If @link mmdParserFinish@ has not been called, the partial document is
+ * freed when the parser created it.  Any callback is cleared.
+ */
 
-	type  = MMD_TYPE_PARAGRAPH;
-	block = NULL;
-      }
-      else
-      {
-       /*
-	* No, just a regular paragraph...
-	*/
+int					/* O - 1 on success, 0 on error */
+mmdParserReset(mmd_parser_t *parser,	/* I - Parser */
+               mmd_t        *root)	/* I - Root node for document or `NULL` for a new document */
+{
+  if (!parser)
+    return (0);
 
-	type = block ? block->type : MMD_TYPE_PARAGRAPH;
-      }
-    }
-    else if (*lineptr == '#' && (lineptr - linestart) < 4)
-    {
-     /*
-      * Heading, count the number of '#' for the heading level...
-      */
+  mmd_ref_clear(&parser->doc);
+
+  if (!parser->finished && parser->created)
+    mmdFree(parser->doc.root);
+
+  mmd_arena_reset(&parser->refarena);
+  mmd_arena_reset(&parser->jobarena);
+
+  memset(&parser->file, 0, sizeof(parser->file));
+  memset(parser->stack, 0, sizeof(parser->stack));
+
+  parser->doc.cb         = NULL;
+  parser->doc.cbdata     = NULL;
+  parser->doc.linesrc    = NULL;
+  parser->doc.linevalid  = 0;
+  parser->doc.refops     = NULL;
+  parser->block          = NULL;
+  parser->pending        = NULL;
+  parser->metadata       = 0;
+  parser->blank_code     = 0;
+  parser->num_columns    = 0;
+  parser->rows           = 0;
+  parser->linelen        = 0;
+  parser->carrylen       = 0;
+  parser->num_jobs       = 0;
+  parser->refops.num_ops = 0;
+
+  if (!mmd_parser_start(parser, root))
+  {
+   /*
+    * Don't allow any more text without a document...
+    */
 
-      DEBUG_puts("     HEADING?\n");
+    parser->finished = 1;
+    return (0);
+  }
 
-      newindent = lineptr - line;
-      temp	= lineptr + 1;
+  return (1);
+}
 
-      while (*temp == '#')
-	temp ++;
 
-      if ((temp - lineptr) <= 6 && isspace(*temp & 255))
-      {
-       /*
-	* Heading 1-6...
-	*/
+/*
+ * 'mmdParserSetCallback()' - Stream the document to an event callback.
+ *
+ * Each top-level block is sent to the callback once it is complete and then
+ * freed, so the memory used depends on the largest block rather than the size
+ * of the document.  This function must be called before any text is fed to the
+ * parser.
+ */
 
-	type  = MMD_TYPE_HEADING_1 + (temp - lineptr - 1);
-	block = NULL;
+void
+mmdParserSetCallback(
+    mmd_parser_t   *parser,		/* I - Parser */
+    mmd_event_cb_t cb,			/* I - Event callback function */
+    void           *cbdata)		/* I - Event callback data */
+{
+  if (!parser || parser->doc.cb || parser->finished || !cb)
+    return;
 
-       /*
-	* Skip whitespace after "#"...
-	*/
+  parser->doc.cb       = cb;
+  parser->doc.cbdata   = cbdata;
+  parser->doc.refarena = &parser->refarena;
 
-	lineptr = temp;
-	while (isspace(*lineptr & 255))
-	  lineptr ++;
+  (cb)(cbdata, parser->doc.root, MMD_EVENT_ENTER_BLOCK);
+}
 
-	linestart = lineptr;
 
-       /*
-	* Strip trailing "#" characters and whitespace...
-	*/
+/*
+ * 'mmdSetOptions()' - Set (enable/disable) support for various markdown options.
+ *
+ * The options are used by @link mmdLoad@, @link mmdLoadBuffer@,
+ * @link mmdLoadFile@, @link mmdLoadString@, and @link mmdParserNew@.  Since
+ * they are shared by all threads, use the "Ex" functions to load documents
+ * with different options at the same time.
+ */
 
-	temp = lineptr + strlen(lineptr) - 1;
-	while (temp > lineptr && isspace(*temp & 255))
-	  *temp-- = '\0';
-	while (temp > lineptr && *temp == '#')
-	  temp --;
-	if (isspace(*temp & 255))
-	{
-	  while (temp > lineptr && isspace(*temp & 255))
-	    *temp-- = '\0';
-	}
-	else if (temp == lineptr)
-	  *temp = '\0';
+void
+mmdSetOptions(mmd_option_t options)	/* I - Options */
+{
+  mmd_options = options;
+}
 
-	while (stackptr > stack && stackptr->indent > newindent)
-	  stackptr --;
 
-	block = mmd_add(stackptr->parent, type, 0, NULL, NULL);
-      }
-      else
-      {
-       /*
-	* More than 6 #'s, just treat as a paragraph...
-	*/
+/*
+ * 'mmd_add()' - Add a new markdown node.
+ */
 
-	type = MMD_TYPE_PARAGRAPH;
-      }
-    }
-    else if (block && block->type >= MMD_TYPE_HEADING_1 && block->type <= MMD_TYPE_HEADING_6)
-    {
-      DEBUG_puts("     PARAGRAPH\n");
+static mmd_t *				/* O - New node */
+mmd_add(_mmd_doc_t *doc,		/* I - Document */
+	mmd_t	   *parent,		/* I - Parent node */
+	mmd_type_t type,		/* I - Node type */
+	int	   whitespace,		/* I - 1 if whitespace precedes this node */
+	char	   *text,		/* I - Text, if any */
+	char	   *url)		/* I - URL, if any */
+{
+  mmd_t		*temp;			/* New node */
 
-      type  = MMD_TYPE_PARAGRAPH;
-      block = NULL;
-    }
-    else if (!block)
-    {
-      type = MMD_TYPE_PARAGRAPH;
 
-      if (lineptr == line && stackptr->parent->type != MMD_TYPE_TABLE)
-	stackptr = stack;
-    }
-    else
-      type = block->type;
+  DEBUG2_printf("Adding %s to %p(%s), whitespace=%d, text=\"%s\", url=\"%s\"\n", mmd_type_string(type), parent, parent ? mmd_type_string(parent->type) : "", whitespace, text ? text : "(null)", url ? url : "(null)");
 
-    if (!*lineptr)
-    {
-      if (stackptr->parent->type == MMD_TYPE_CODE_BLOCK)
-	blank_code ++;
-      else if (stackptr->parent->type == MMD_TYPE_BLOCK_QUOTE && line[0] != '>')
-	stackptr --;
+  if (!parent)
+  {
+   /*
+    * Only document nodes can be at the root, and they own the memory arena for
+    * the rest of the document...
+    */
 
-      block = NULL;
-      continue;
-    }
-    else if (!strcmp(lineptr, "+"))
-    {
-      if (block)
-      {
-	if (block->type == MMD_TYPE_LIST_ITEM)
-	  block = mmd_add(block, MMD_TYPE_PARAGRAPH, 0, NULL, NULL);
-	else if (block->parent->type == MMD_TYPE_LIST_ITEM)
-	  block = mmd_add(block->parent, MMD_TYPE_PARAGRAPH, 0, NULL, NULL);
-	else
-	  block = NULL;
-      }
-      continue;
-    }
-    else if ((mmd_options & MMD_OPTION_TABLES) && strchr(lineptr, '|') && (stackptr->parent->type == MMD_TYPE_TABLE || mmd_is_table(&file, stackptr->indent)))
-    {
-     /*
-      * Table...
-      */
+    if (type != MMD_TYPE_DOCUMENT)
+      return (NULL);
 
-      int	col;			/* Current column */
-      char	*start,			/* Start of column/cell */
-		*end;			/* End of column/cell */
-      mmd_t	*row = NULL,		/* Current row */
-		*cell;			/* Current cell */
+    return ((mmd_t *)calloc(1, sizeof(_mmd_root_t)));
+  }
 
-      DEBUG2_printf("TABLE stackptr->parent=%p (%d), rows=%d\n", stackptr->parent, stackptr->parent->type, rows);
+  if (doc->cb && parent == doc->root && parent->last_child)
+  {
+   /*
+    * The previous top-level block is complete, so send it to the callback and
+    * then reuse its memory...
+    */
 
-      if (stackptr->parent->type != MMD_TYPE_TABLE && stackptr < (stack + sizeof(stack) / sizeof(stack[0]) - 1))
-      {
-	DEBUG2_printf("ADDING NEW TABLE to %p (%s)\n", stackptr->parent, mmd_type_string(stackptr->parent->type));
+    temp = parent->last_child;
 
-	stackptr[1].parent = mmd_add(stackptr->parent, MMD_TYPE_TABLE, 0, NULL, NULL);
-	stackptr[1].indent = stackptr->indent;
-	stackptr[1].fence  = '\0';
-	stackptr ++;
+    mmd_emit(doc, temp);
+    mmd_remove(temp);
+    mmd_arena_reset(doc->arena);
+  }
 
-	block = mmd_add(stackptr->parent, MMD_TYPE_TABLE_HEADER, 0, NULL, NULL);
+  if ((temp = mmd_arena_alloc(doc->arena, sizeof(mmd_t))) != NULL)
+  {
+    memset(temp, 0, sizeof(mmd_t));
 
-	for (col = 0; col < (int)(sizeof(columns) / sizeof(columns[0])); col ++)
-	  columns[col] = MMD_TYPE_TABLE_BODY_CELL_LEFT;
+   /*
+    * Add node to the parent...
+    */
 
-	num_columns = 0;
-	rows	    = -1;
-      }
-      else if (rows > 0)
-      {
-	if (rows == 1)
-	  block = mmd_add(stackptr->parent, MMD_TYPE_TABLE_BODY, 0, NULL, NULL);
-      }
-      else
-	block = NULL;
+    temp->parent = parent;
 
-      if (block)
-	row = mmd_add(block, MMD_TYPE_TABLE_ROW, 0, NULL, NULL);
+    if (parent->last_child)
+    {
+      parent->last_child->next_sibling = temp;
+      temp->prev_sibling		 = parent->last_child;
+      parent->last_child		 = temp;
+    }
+    else
+    {
+      parent->first_child = parent->last_child = temp;
+    }
 
-      if (*lineptr == '|')
-	lineptr ++;			/* Skip leading pipe */
+   /*
+    * Copy the node values...
+    */
 
-      if ((end = lineptr + strlen(lineptr) - 1) > lineptr)
-      {
-	while ((*end == '\n' || *end == 'r') && end > lineptr)
-	  end --;
+    temp->type	     = type;
+    temp->whitespace = (short)whitespace;
 
-	if (end > lineptr && *end == '|')
-	  *end = '\0';			/* Truncate trailing pipe */
-      }
+    if (text)
+    {
+      temp->textlen = strlen(text);
 
-      for (col = 0; lineptr && *lineptr && col < (int)(sizeof(columns) / sizeof(columns[0])); col ++)
+      if (doc->linesrc && text >= doc->line && (text + temp->textlen) <= (doc->line + doc->linevalid))
       {
        /*
-	* Get the bounds of the stackptr->parent cell...
+	* Text is unchanged from the document source, so just reference it -
+	* anything that changes the line must lower linevalid first...
 	*/
 
-	start = lineptr;
-	if ((lineptr = strchr(lineptr + 1, '|')) != NULL)
-	  *lineptr++ = '\0';
-
-	if (block)
+#if DEBUG
+	if (memcmp(doc->linesrc + (text - doc->line), text, temp->textlen))
 	{
-	 /*
-	  * Add a cell to this row...
-	  */
+	  DEBUG_printf("mmd_add: Span \"%s\" does not match the source.\n", text);
+	  abort();
+	}
+#endif /* DEBUG */
 
-	  if (block->type == MMD_TYPE_TABLE_HEADER)
-	    cell = mmd_add(row, MMD_TYPE_TABLE_HEADER_CELL, 0, NULL, NULL);
-	  else
-	    cell = mmd_add(row, columns[col], 0, NULL, NULL);
+	temp->text = (char *)doc->linesrc + (text - doc->line);
+	temp->span = 1;
+      }
+      else
+	temp->text = mmd_arena_strdup(doc->arena, text);
+    }
 
-	  mmd_parse_inline(&doc, cell, start);
-	}
-	else
-	{
-	 /*
-	  * Process separator row for alignment...
-	  */
+    if (url)
+      temp->url = mmd_arena_strdup(doc->arena, url);
+  }
 
-	  while (isspace(*start & 255))
-	    start ++;
+  return (temp);
+}
 
-	  for (end = start + strlen(start) - 1; end > start && isspace(*end & 255); end --)
-	    ;				/* Find the last non-space character */
 
-	  if (*start == ':' && *end == ':')
-	    columns[col] = MMD_TYPE_TABLE_BODY_CELL_CENTER;
-	  else if (*end == ':')
-	    columns[col] = MMD_TYPE_TABLE_BODY_CELL_RIGHT;
+/*
+ * 'mmd_arena()' - Find the memory arena for a node.
+ */
 
-	  DEBUG2_printf("COLUMN %d SEPARATOR=\"%s\", TYPE=%d\n", col, start, columns[col]);
-	}
-      }
+static _mmd_arena_t *			/* O - Memory arena or `NULL` if none */
+mmd_arena(mmd_t *node)			/* I - Node */
+{
+  while (node->parent)
+    node = node->parent;
 
-     /*
-      * Make sure the table is balanced...
-      */
-
-      if (col > num_columns)
-      {
-	num_columns = col;
-      }
-      else if (block && block->type != MMD_TYPE_TABLE_HEADER)
-      {
-	while (col < num_columns)
-	{
-	  mmd_add(row, columns[col], 0, NULL, NULL);
-	  col ++;
-	}
-      }
-
-      rows ++;
-      continue;
-    }
-    else if (stackptr->parent->type == MMD_TYPE_TABLE)
-    {
-      DEBUG2_puts("END TABLE\n");
-      stackptr --;
-      block = NULL;
-    }
-
-    if (stackptr->parent->type != MMD_TYPE_CODE_BLOCK && (!block || block->type == MMD_TYPE_CODE_BLOCK) && (lineptr - linestart) >= (stackptr->indent + 4))
-    {
-     /*
-      * Indented code block.
-      */
-
-      if (stackptr->parent->type != MMD_TYPE_CODE_BLOCK && stackptr < (stack + sizeof(stack) / sizeof(stack[0]) - 1))
-      {
-	stackptr[1].parent = mmd_add(stackptr->parent, MMD_TYPE_CODE_BLOCK, 0, NULL, NULL);
-	stackptr[1].indent = stackptr->indent + 4;
-	stackptr[1].fence  = '\0';
-	stackptr ++;
+  return (node->type == MMD_TYPE_DOCUMENT ? &((_mmd_root_t *)node)->arena : NULL);
+}
 
-	blank_code = 0;
-      }
 
-      while (blank_code > 0)
-      {
-	mmd_add(stackptr->parent, MMD_TYPE_CODE_TEXT, 0, "\n", NULL);
-	blank_code --;
-      }
+/*
+ * 'mmd_arena_alloc()' - Allocate memory from an arena.
+ *
+ * Memory is allocated from large chunks that are only freed with the arena.
+ * Chunk sizes double as the arena grows, up to `MMD_ARENA_MAX` bytes, and
+ * allocations that don't fit in a chunk get a chunk of their own.
+ */
 
-      mmd_add(stackptr->parent, MMD_TYPE_CODE_TEXT, 0, line + stackptr->indent, NULL);
+static void *				/* O - Pointer to memory or `NULL` on error */
+mmd_arena_alloc(_mmd_arena_t *arena,	/* I - Memory arena */
+		size_t	     bytes)	/* I - Number of bytes */
+{
+  _mmd_chunk_t	*chunk = arena->chunks;	/* Current chunk */
+  void		*ptr;			/* Allocated memory */
 
-      continue;
-    }
 
-    if (!block || block->type != type)
-    {
-      if (stackptr->parent->type == MMD_TYPE_CODE_BLOCK)
-	stackptr --;
+ /*
+  * Keep everything aligned for pointers...
+  */
 
-      block = mmd_add(stackptr->parent, type, 0, NULL, NULL);
-    }
+  bytes = (bytes + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
 
+  if (!chunk || (chunk->size - chunk->used) < bytes)
+  {
    /*
-    * Read continuation lines before parsing this...
+    * Allocate a new chunk...
     */
 
-    while (mmd_has_continuation(line, &file, stackptr->indent))
-    {
-      char *ptr = line + strlen(line);
+    size_t	size;			/* Size of new chunk */
 
-      if (!mmd_read_line(&file, ptr, sizeof(line) - (size_t)(ptr - line)))
-	break;
-      else if (line[0] == '>' && *ptr == '>')
-	memmove(ptr, ptr + 1, strlen(ptr));
-    }
+    if (arena->chunksize < MMD_ARENA_MIN)
+      arena->chunksize = MMD_ARENA_MIN;
 
-    mmd_parse_inline(&doc, block, lineptr);
+    if ((size = arena->chunksize) < bytes)
+      size = bytes;
+    else if (arena->chunksize < MMD_ARENA_MAX)
+      arena->chunksize *= 2;
 
-    if (block->type == MMD_TYPE_PARAGRAPH && !block->first_child)
-    {
-      mmd_remove(block);
-      mmd_free(block);
-      block = NULL;
-    }
-  }
+    if ((chunk = malloc(sizeof(_mmd_chunk_t) + size)) == NULL)
+      return (NULL);
 
- /*
-  * Free any references...
-  */
+    chunk->size = size;
+    chunk->used = 0;
 
-  for (i = doc.num_references, reference = doc.references; i > 0; i --, reference ++)
-  {
-    if (reference->pending)
+    if (size > bytes || !arena->chunks)
     {
-      char	text[8192];		/* Reference text */
-      size_t	j;			/* Looping var */
-
-      DEBUG2_printf("Clearing links for '%s'.\n", reference->name);
-      snprintf(text, sizeof(text), "[%s]", reference->name);
-
-      for (j = 0; j < reference->num_pending; j ++)
-      {
-	free(reference->pending[j]->text);
-	reference->pending[j]->text = strdup(text);
-	reference->pending[j]->type = MMD_TYPE_NORMAL_TEXT;
-      }
+     /*
+      * Allocate from this chunk going forward...
+      */
 
-      free(reference->pending);
+      chunk->next   = arena->chunks;
+      arena->chunks = chunk;
     }
+    else
+    {
+     /*
+      * Large allocation, keep using the current chunk...
+      */
 
-    free(reference->name);
-    free(reference->url);
+      chunk->next	    = arena->chunks->next;
+      arena->chunks->next = chunk;
+    }
   }
 
-  free(doc.references);
+  ptr	      = (char *)(chunk + 1) + chunk->used;
+  chunk->used += bytes;
 
- /*
-  * Return the root node...
-  */
-
-  return (doc.root);
+  return (ptr);
 }
 
 
 /*
- * 'mmdLoadString()' - Load a markdown string into nodes.
+ * 'mmd_arena_free()' - Free all memory used by an arena.
  */
 
-mmd_t *					/* O - Root node in markdown */
-mmdLoadString(mmd_t      *root,		/* I - Root node for document or `NULL` for a new document */
-              const char *s)		/* I - String to load */
+static void
+mmd_arena_free(_mmd_arena_t *arena)	/* I - Memory arena */
 {
-  FILE		*fp;			/* File */
-
-
-#if _WIN32
- /*
-  * Windows does not provide the POSIX fmemopen, so create a temporary file and
-  * have MMD read it...
-  */
-
-  char		tempfile[1024];		/* Temporary filename */
-
-  if (tempnam_s(tempfile, sizeof(tempfile))
-    return (root);
+  _mmd_chunk_t	*chunk,			/* Current chunk */
+		*next;			/* Next chunk */
 
-  if ((fp = fopen(tempfile, "w+")) == NULL)
-    return (root);
 
-  fputs(fp, s);
-  frewind(fp);
+  for (chunk = arena->chunks; chunk; chunk = next)
+  {
+    next = chunk->next;
+    free(chunk);
+  }
 
-#else // POSIX
- /*
-  * Open the string as a file...
-  */
+  arena->chunks    = NULL;
+  arena->chunksize = 0;
+}
 
-  if ((fp = fmemopen((void *)s, strlen(s), "r")) == NULL)
-    return (root);
-#endif // _WIN32
 
- /*
-  * Load the string...
-  */
+/*
+ * 'mmd_arena_merge()' - Move all of the memory from one arena to another.
+ *
+ * The chunks are added after the current chunk so that allocations continue
+ * from it.
+ */
 
-  root = mmdLoadFile(root, fp);
+static void
+mmd_arena_merge(_mmd_arena_t *arena,	/* I - Memory arena */
+		_mmd_arena_t *from)	/* I - Memory arena to move */
+{
+  _mmd_chunk_t	*last;			/* Last chunk to move */
 
- /*
-  * Close the memory file...
-  */
 
-  fclose(fp);
+  if (!from->chunks)
+    return;
 
-#if _WIN32
- /*
-  * Remove the temporary file...
-  */
+  if (arena->chunks)
+  {
+    for (last = from->chunks; last->next; last = last->next);
 
-  unlink(tempfile);
-#endif // _WIN32
+    last->next          = arena->chunks->next;
+    arena->chunks->next = from->chunks;
+  }
+  else
+  {
+    arena->chunks    = from->chunks;
+    arena->chunksize = from->chunksize;
+  }
 
-  return (root);
+  from->chunks    = NULL;
+  from->chunksize = 0;
 }
 
 
 /*
- * 'mmdSetOptions()' - Set (enable/disable) support for various markdown options.
+ * 'mmd_arena_reset()' - Release all allocations in an arena.
+ *
+ * The current chunk is kept for new allocations and all others are freed.
  */
 
-void
-mmdSetOptions(mmd_option_t options)	/* I - Options */
+static void
+mmd_arena_reset(_mmd_arena_t *arena)	/* I - Memory arena */
 {
-  mmd_options = options;
+  _mmd_chunk_t	*chunk,			/* Current chunk */
+		*next;			/* Next chunk */
+
+
+  if (!arena->chunks)
+    return;
+
+  for (chunk = arena->chunks->next; chunk; chunk = next)
+  {
+    next = chunk->next;
+    free(chunk);
+  }
+
+  arena->chunks->next = NULL;
+  arena->chunks->used = 0;
 }
 
 
 /*
- * 'mmd_add()' - Add a new markdown node.
+ * 'mmd_arena_read()' - Read an entire file into an arena.
+ *
+ * The file is read into its own chunk, which is grown as needed and then added
+ * to the arena.  The returned buffer is nul-terminated.
  */
 
-static mmd_t *				/* O - New node */
-mmd_add(mmd_t	   *parent,		/* I - Parent node */
-	mmd_type_t type,		/* I - Node type */
-	int	   whitespace,		/* I - 1 if whitespace precedes this node */
-	char	   *text,		/* I - Text, if any */
-	char	   *url)		/* I - URL, if any */
+static char *				/* O - File contents or `NULL` on error */
+mmd_arena_read(_mmd_arena_t *arena,	/* I - Memory arena */
+	       FILE	    *fp,	/* I - File to read */
+	       size_t	    *bytes)	/* O - Number of bytes read */
 {
-  mmd_t		*temp;			/* New node */
+  _mmd_chunk_t	*chunk = NULL,		/* File chunk */
+		*temp;			/* New file chunk */
+  size_t	size = 0,		/* Size of chunk */
+		used = 0,		/* Bytes read */
+		count;			/* Bytes in current read */
 
 
-  DEBUG2_printf("Adding %s to %p(%s), whitespace=%d, text=\"%s\", url=\"%s\"\n", mmd_type_string(type), parent, parent ? mmd_type_string(parent->type) : "", whitespace, text ? text : "(null)", url ? url : "(null)");
-
-  if (!parent && type != MMD_TYPE_DOCUMENT)
-    return (NULL);			/* Only document nodes can be at the root */
-
-  if ((temp = calloc(1, sizeof(mmd_t))) != NULL)
+  do
   {
-    if (parent)
+    if ((size - used) < 2)
     {
-     /*
-      * Add node to the parent...
-      */
+      size = size ? 2 * size : 65536;
 
-      temp->parent = parent;
-
-      if (parent->last_child)
-      {
-	parent->last_child->next_sibling = temp;
-	temp->prev_sibling		 = parent->last_child;
-	parent->last_child		 = temp;
-      }
-      else
+      if ((temp = realloc(chunk, sizeof(_mmd_chunk_t) + size)) == NULL)
       {
-	parent->first_child = parent->last_child = temp;
+	free(chunk);
+	return (NULL);
       }
+
+      chunk = temp;
     }
 
-   /*
-    * Copy the node values...
-    */
+    count = fread((char *)(chunk + 1) + used, 1, size - used - 1, fp);
+    used  += count;
+  }
+  while (count > 0);
 
-    temp->type	     = type;
-    temp->whitespace = whitespace;
+  ((char *)(chunk + 1))[used] = '\0';
 
-    if (text)
-      temp->text = strdup(text);
+ /*
+  * Add the chunk after the current one since it is full...
+  */
 
-    if (url)
-      temp->url = strdup(url);
+  chunk->size = size;
+  chunk->used = size;
+
+  if (arena->chunks)
+  {
+    chunk->next		= arena->chunks->next;
+    arena->chunks->next = chunk;
+  }
+  else
+  {
+    chunk->next   = NULL;
+    arena->chunks = chunk;
   }
 
-  return (temp);
+  *bytes = used;
+
+  return ((char *)(chunk + 1));
+}
+
+
+/*
+ * 'mmd_arena_strdup()' - Copy a string into an arena.
+ */
+
+static char *				/* O - Copy of string or `NULL` on error */
+mmd_arena_strdup(_mmd_arena_t *arena,	/* I - Memory arena */
+		 const char   *s)	/* I - String */
+{
+  size_t	len = strlen(s) + 1;	/* Length of string with nul */
+  char		*copy;			/* Copy of string */
+
+
+  if ((copy = mmd_arena_alloc(arena, len)) != NULL)
+    memcpy(copy, s, len);
+
+  return (copy);
 }
 
 
 /*
- * 'mmd_free()' - Free memory used by a node.
+ * 'mmd_emit()' - Send a block and its children to the event callback.
  */
 
 static void
-mmd_free(mmd_t *node)			/* I - Node */
+mmd_emit(_mmd_doc_t *doc,		/* I - Document */
+         mmd_t      *node)		/* I - Block node */
 {
-  free(node->text);
-  free(node->url);
-  free(node->extra);
-  free(node);
+  mmd_t		*current;		/* Current child node */
+
+
+  (doc->cb)(doc->cbdata, node, MMD_EVENT_ENTER_BLOCK);
+
+  for (current = node->first_child; current; current = current->next_sibling)
+  {
+    switch (current->type)
+    {
+      case MMD_TYPE_LINKED_TEXT :
+          (doc->cb)(doc->cbdata, current, MMD_EVENT_LINK);
+	  break;
+
+      case MMD_TYPE_IMAGE :
+          (doc->cb)(doc->cbdata, current, MMD_EVENT_IMAGE);
+	  break;
+
+      case MMD_TYPE_CHECKBOX :
+          (doc->cb)(doc->cbdata, current, MMD_EVENT_CHECKBOX);
+	  break;
+
+      default :
+          if (current->type < MMD_TYPE_NORMAL_TEXT)
+	    mmd_emit(doc, current);
+	  else
+	    (doc->cb)(doc->cbdata, current, MMD_EVENT_TEXT);
+	  break;
+    }
+  }
+
+  (doc->cb)(doc->cbdata, node, MMD_EVENT_LEAVE_BLOCK);
 }
 
 
@@ -1346,20 +1717,47 @@ mmd_has_continuation(
 {
   const char	*lineptr = line;	/* Pointer into current line */
   const char	*fileptr = file->bufptr;/* Pointer into next line */
+  _mmd_line_t	*next = mmd_next_line(file),
+					/* Record for next line */
+		rest;			/* Record for rest of next line */
 
 
   if (*fileptr == '\n' || *fileptr == '\r')
     return (0);
 
+  if (!(next->flags & MMD_LINE_QUOTE))
+  {
+   /*
+    * The next line is not in a block quote, so its record has everything we
+    * need...
+    */
+
+    while (mmd_isspace(*lineptr))
+      lineptr ++;
+
+    if (*lineptr == '[' && (lineptr - line - indent) < 4 && (*fileptr == ' ' || *fileptr == '\t'))
+      return (1);
+
+    if ((next->flags & (MMD_LINE_BLANK | MMD_LINE_BREAK)) || *lineptr == '#')
+      return (0);
+
+    return (next->textoffset <= indent);
+  }
+
+ /*
+  * Otherwise match up the block quote markers in both lines and look at the
+  * rest of the next line...
+  */
+
   do
   {
-    while (isspace(*lineptr & 255))
+    while (mmd_isspace(*lineptr))
       lineptr ++;
 
     if (*lineptr == '[' && (lineptr - line - indent) < 4 && (*fileptr == ' ' || *fileptr == '\t'))
       return (1);
 
-    while (isspace(*fileptr & 255))
+    while (*fileptr != '\n' && mmd_isspace(*fileptr))
       fileptr ++;
 
     if (*lineptr == '>' && *fileptr == '>')
@@ -1373,89 +1771,92 @@ mmd_has_continuation(
     if (*fileptr == '\n' || *fileptr == '\r')
       return (0);
   }
-  while (isspace(*lineptr & 255) || isspace(*fileptr & 255));
+  while (mmd_isspace(*lineptr) || mmd_isspace(*fileptr));
 
   if (*lineptr == '#')
     return (0);
 
-  if (strchr("-+*", *fileptr) && isspace(fileptr[1] & 255))
-  {
-   /*
-    * Bullet list item...
-    */
+  mmd_scan_line(&rest, fileptr, NULL);
 
+  if (rest.flags & MMD_LINE_BREAK)
     return (0);
-  }
 
-  if (isdigit(*fileptr & 255))
-  {
-   /*
-    * Ordered list item...
-    */
+  return ((fileptr - file->bufptr + rest.textoffset) <= indent);
+}
 
-    while (*fileptr && isdigit(*fileptr & 255))
-      fileptr ++;
 
-    if (*fileptr == '.' || *fileptr == '(')
-      return (0);
-  }
+/*
+ * 'mmd_has_lines()' - Determine whether the current and next lines are
+ *                     complete.
+ */
 
-  if (mmd_is_codefence((char *)fileptr, '\0', 0, NULL))
-    return (0);
+static int				/* O - 1 if both lines are complete, 0 otherwise */
+mmd_has_lines(_mmd_filebuf_t *file)	/* I - Input buffer */
+{
+  char		*start,			/* Start of line */
+		*ptr,			/* Pointer into buffer */
+		*end;			/* End of buffer */
 
-  if (mmd_is_chars(fileptr, "- \t", 3) || mmd_is_chars(fileptr, "_ \t", 3) || mmd_is_chars(fileptr, "* \t", 3))
-  {
-   /*
-    * Thematic break...
-    */
 
-    return (0);
-  }
+ /*
+  * The records for lines found by earlier calls are remembered until the
+  * lines are read, so each line is only scanned once...
+  */
 
-  if (mmd_is_chars(fileptr, "-", 1) || mmd_is_chars(fileptr, "=", 1))
+  if (!file->lines[0].end)
   {
-   /*
-    * Heading...
-    */
+    if ((ptr = memchr(file->bufptr, '\n', (size_t)(file->bufend - file->bufptr))) == NULL)
+      return (0);
 
-    return (0);
+    mmd_scan_line(file->lines, file->bufptr, ptr + 1);
   }
 
-  if (*fileptr == '#')
+  if (!file->lines[1].end)
   {
-   /*
-    * Possible heading...
-    */
+    ptr = file->lines[0].end;
+    end = file->bufend;
 
-    int count = 0;
-
-    while (*fileptr == '#')
+    if (ptr >= end)
     {
-      fileptr ++;
-      count ++;
+     /*
+      * The next line starts in the next buffer...
+      */
+
+      if (!file->nextptr)
+	return (0);
+
+      ptr = file->nextptr;
+      end = file->nextend;
     }
 
-    if (count <= 6)
+    start = ptr;
+
+    if ((ptr = memchr(ptr, '\n', (size_t)(end - ptr))) == NULL)
       return (0);
+
+    mmd_scan_line(file->lines + 1, start, ptr + 1);
   }
 
-  return ((fileptr - file->bufptr) <= indent);
+  return (1);
 }
 
 
 /*
  * 'mmd_is_chars()' - Determine whether a line consists solely of whitespace
  *		      and the specified character.
+ *
+ * When more than one character is required, spaces and tabs may also appear
+ * between the characters.
  */
 
 static size_t				/* O - 1 if as specified, 0 otherwise */
 mmd_is_chars(const char *lineptr,	/* I - Current line */
-	     const char *chars,		/* I - Non-space character */
+	     int	ch,		/* I - Non-space character */
 	     size_t	minchars)	/* I - Minimum number of non-space characters */
 {
   size_t	found_ch = 0;		/* Did we find the specified characters? */
 
-  while (*lineptr == *chars)
+  while (*lineptr == ch)
   {
     found_ch ++;
     lineptr ++;
@@ -1463,16 +1864,16 @@ mmd_is_chars(const char *lineptr,	/* I - Current line */
 
   if (minchars > 1)
   {
-    while (*lineptr && strchr(chars, *lineptr))
+    while (*lineptr == ch || mmd_ischar(*lineptr, MMD_CHAR_BLANK))
     {
-      if (*lineptr == *chars)
+      if (*lineptr == ch)
 	found_ch ++;
 
       lineptr ++;
     }
   }
 
-  while (*lineptr && isspace(*lineptr & 255) && *lineptr != '\n')
+  while (*lineptr && mmd_isspace(*lineptr) && *lineptr != '\n')
     lineptr ++;
 
   if ((*lineptr && *lineptr != '\n') || found_ch < minchars)
@@ -1520,17 +1921,17 @@ mmd_is_codefence(char	*lineptr,	/* I - Line */
     return (0);
   else if (*lineptr && *lineptr != '\n' && !fence)
   {
-    if (match == '`' && strchr(lineptr, match))
+    if (match == '`' && lineptr[strcspn(lineptr, "`\n")] == '`')
       return (0);
 
-    while (isspace(*lineptr & 255))
+    while (*lineptr != '\n' && mmd_isspace(*lineptr))
       lineptr ++;
 
-    if (*lineptr && language)
+    if (*lineptr && *lineptr != '\n' && language)
     {
       *language = lineptr;
 
-      while (*lineptr && !isspace(*lineptr & 255))
+      while (*lineptr && !mmd_isspace(*lineptr))
 	lineptr ++;
       *lineptr = '\0';
     }
@@ -1549,65 +1950,175 @@ static int				/* O - 1 if this is a table, 0 otherwise */
 mmd_is_table(_mmd_filebuf_t *file,	/* I - File to read from */
 	     int	    indent)	/* I - Indentation of table line */
 {
-  const char	*ptr;			/* Pointer into buffer */
+  _mmd_line_t	*next = mmd_next_line(file);
+					/* Record for next line */
 
 
-  ptr = file->bufptr;
-  while (*ptr)
-  {
-    if (!strchr(" \t>", *ptr))
-      break;
+  return ((next->flags & MMD_LINE_TABLE) && (next->quote - indent) < 4);
+}
 
-    ptr ++;
-  }
 
-  if ((ptr - file->bufptr - indent) >= 4)
+/*
+ * 'mmd_is_top_level()' - Determine whether a parser is back at the top level.
+ *
+ * This is the case after a blank line when a following ATX heading at column 0
+ * would close all of the open blocks, so the rest of the document parses the
+ * same as it would in a new parser.
+ */
+
+static int				/* O - 1 if at top level, 0 otherwise */
+mmd_is_top_level(mmd_parser_t *parser)	/* I - Parser */
+{
+  _mmd_stack_t	*stack;			/* Current stack entry */
+
+
+  if (parser->metadata || parser->pending || parser->block)
     return (0);
 
-  while (*ptr)
+  for (stack = parser->stack + 1; stack <= parser->stackptr; stack ++)
   {
-    if (!strchr(" \t:-|", *ptr))
-      break;
-
-    ptr ++;
+    if (stack->indent == 0 || stack->fence)
+      return (0);
   }
 
-  return (*ptr == '\r' || *ptr == '\n');
+  return (1);
 }
 
 
 /*
- * 'mmd_parse_inline()' - Parse inline formatting.
+ * 'mmd_next_line()' - Get the record for the next line in the buffer.
+ *
+ * The record is normally made by @code mmd_has_lines@; at the end of the input
+ * it is made here for the last lines.
  */
 
-static void
-mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
-		 mmd_t	    *parent,	/* I - Parent node */
-		 char	    *lineptr)	/* I - Pointer into line */
+static _mmd_line_t *			/* O - Record for next line */
+mmd_next_line(_mmd_filebuf_t *file)	/* I - Input buffer */
 {
-  mmd_t		*node;			/* New node */
-  mmd_type_t	type;			/* Current node type */
-  int		whitespace;		/* Whitespace precedes? */
-  char		*text,			/* Text fragment in line */
-		*title,			/* Link title */
-		*url,			/* URL in link */
-		*refname;		/* Reference name */
-  const char	*delim = NULL;		/* Delimiter */
+  char		*end;			/* End of line */
+
+
+  if (!file->lines[0].end)
+  {
+    if ((end = memchr(file->bufptr, '\n', (size_t)(file->bufend - file->bufptr))) != NULL)
+      end ++;
+    else
+      end = file->bufend;
+
+    mmd_scan_line(file->lines, file->bufptr, end);
+  }
+
+  return (file->lines);
+}
+
+
+/*
+ * 'mmd_parse_find()' - Find the next closing delimiter in a line.
+ *
+ * The result of the last search for each delimiter is remembered, so looking
+ * ahead from every opening delimiter in a line only scans the line once per
+ * kind of delimiter.  Text ahead of the current position must not change
+ * between calls unless the remembered searches are cleared.
+ */
+
+static const char *			/* O - Pointer to delimiter or `NULL` if none */
+mmd_parse_find(_mmd_find_t *finds,	/* I - Remembered searches */
+	       const char  *lineptr,	/* I - Pointer into line */
+	       const char  *delim)	/* I - Delimiter: "*", "**", "_", "__", "`", "``", "```", or ">" */
+{
+  _mmd_find_t	*find;			/* Search for this delimiter */
+
+
+  switch (*delim)
+  {
+    case '*' :
+        find = finds;
+        break;
+    case '_' :
+        find = finds + 2;
+        break;
+    case '`' :
+        find = finds + 4;
+        break;
+    default :
+        find = finds + 7;
+        break;
+  }
+
+  find += strlen(delim) - 1;
+
+  if (!find->start || lineptr < find->start || (find->found && lineptr > find->found))
+  {
+    find->start = lineptr;
+    find->found = strstr(lineptr, delim);
+  }
+
+  return (find->found);
+}
+
+
+/*
+ * 'mmd_parse_inline()' - Parse inline formatting.
+ */
+
+static void
+mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
+		 mmd_t	    *parent,	/* I - Parent node */
+		 int	    whitespace,	/* I - 1 if whitespace precedes the text */
+		 char	    *lineptr)	/* I - Pointer into line */
+{
+  mmd_t		*node;			/* New node */
+  mmd_type_t	type;			/* Current node type */
+  char		*text,			/* Text fragment in line */
+		*textptr = NULL,	/* End of text fragment */
+		*title,			/* Link title */
+		*url,			/* URL in link */
+		*refname;		/* Reference name */
+  const char	*delim = NULL;		/* Delimiter */
   size_t	delimlen = 0;		/* Length of delimiter */
+  _mmd_find_t	finds[8];		/* Look-ahead for closing delimiters */
 
 
-  whitespace = parent->last_child != NULL;
+  memset(finds, 0, sizeof(finds));
 
   for (text = NULL, type = MMD_TYPE_NORMAL_TEXT; *lineptr; lineptr ++)
   {
     DEBUG2_printf("mmd_parse_inline: lineptr=%p(\"%32.32s...\"), type=%d, text=%p, whitespace=%d\n", lineptr, lineptr, type, text, whitespace);
 
-    if (isspace(*lineptr & 255) && type != MMD_TYPE_CODE_TEXT)
+    if (mmd_isspace(*lineptr) && type != MMD_TYPE_CODE_TEXT)
     {
+      if (text && (doc->options & MMD_OPTION_RUNS) && strncmp(lineptr + 1, " \n", 2))
+      {
+       /*
+        * Keep the run going when the next word is plain text, collapsing the
+        * whitespace to a single space...
+        */
+
+        char *next = lineptr + 1;	/* Start of next word */
+
+	while (mmd_isspace(*next))
+	{
+	  if (*next == '\n' && next[-1] == ' ' && next[-2] == ' ')
+	    break;			/* Hard break */
+
+	  next ++;
+	}
+
+	if (*next && *next != '\n' && *next != '\\' && !mmd_ischar(*next, MMD_CHAR_INLINE))
+	{
+	  if ((*lineptr != ' ' || next > (lineptr + 1)) && doc->linevalid > (size_t)(textptr - doc->line))
+	    doc->linevalid = (size_t)(textptr - doc->line);
+
+	  *textptr++ = ' ';
+	  lineptr    = next - 1;
+	  continue;
+	}
+      }
+
       if (text)
       {
-	*lineptr = '\0';
-	mmd_add(parent, type, whitespace, text, NULL);
+	*textptr = '\0';
+	mmd_add(doc, parent, type, whitespace, text, NULL);
 
 	text = NULL;
       }
@@ -1615,7 +2126,7 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
       if (!strncmp(lineptr + 1, " \n", 2) && lineptr[3])
       {
 	DEBUG2_printf("mmd_parse_inline: Adding hard break to %p(%d)\n", parent, parent->type);
-	mmd_add(parent, MMD_TYPE_HARD_BREAK, 0, NULL, NULL);
+	mmd_add(doc, parent, MMD_TYPE_HARD_BREAK, 0, NULL, NULL);
 	lineptr += 2;
 	whitespace = 0;
       }
@@ -1632,7 +2143,8 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 
       if (text)
       {
-	mmd_add(parent, type, whitespace, text, NULL);
+	*textptr = '\0';
+	mmd_add(doc, parent, type, whitespace, text, NULL);
 
 	text	   = NULL;
 	whitespace = 0;
@@ -1642,7 +2154,7 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 
       if (url || refname)
       {
-	node = mmd_add(parent, MMD_TYPE_IMAGE, whitespace, text, url);
+	node = mmd_add(doc, parent, MMD_TYPE_IMAGE, whitespace, text, url);
 
 	if (refname)
 	  mmd_ref_add(doc, node, refname, NULL, NULL);
@@ -1663,18 +2175,18 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 
       if (text)
       {
-        *lineptr = '\0';
-	mmd_add(parent, type, whitespace, text, NULL);
+        *textptr = '\0';
+	mmd_add(doc, parent, type, whitespace, text, NULL);
 	*lineptr = '[';
 
 	text	   = NULL;
 	whitespace = 0;
       }
 
-      if ((mmd_options & MMD_OPTION_TASKS) && (!strncmp(lineptr, "[ ]", 3) || !strncmp(lineptr, "[x]", 3) || !strncmp(lineptr, "[X]", 3)))
+      if ((doc->options & MMD_OPTION_TASKS) && (!strncmp(lineptr, "[ ]", 3) || !strncmp(lineptr, "[x]", 3) || !strncmp(lineptr, "[X]", 3)))
       {
         // Checkbox
-        mmd_add(parent, MMD_TYPE_CHECKBOX, 0, lineptr[1] == ' ' ? NULL : "x", NULL);
+        mmd_add(doc, parent, MMD_TYPE_CHECKBOX, 0, lineptr[1] == ' ' ? NULL : "x", NULL);
         lineptr += 2;
       }
       else
@@ -1690,13 +2202,13 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 	  if (end > text && *end == '`')
 	    *end = '\0';
 
-	  node = mmd_add(parent, MMD_TYPE_CODE_TEXT, whitespace, text, url);
+	  node = mmd_add(doc, parent, MMD_TYPE_CODE_TEXT, whitespace, text, url);
 	}
 	else if (text)
 	{
-	  node = mmd_add(parent, MMD_TYPE_LINKED_TEXT, whitespace, text, url);
-	  if (title)
-	    node->extra = strdup(title);
+	  node = mmd_add(doc, parent, MMD_TYPE_LINKED_TEXT, whitespace, text, url);
+	  if (node && title)
+	    node->extra = mmd_arena_strdup(doc->arena, title);
 	}
 	else
 	  node = NULL;
@@ -1714,7 +2226,7 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 	lineptr --;
       }
     }
-    else if (*lineptr == '<' && type != MMD_TYPE_CODE_TEXT && strchr(lineptr + 1, '>'))
+    else if (*lineptr == '<' && type != MMD_TYPE_CODE_TEXT && mmd_parse_find(finds, lineptr + 1, ">"))
     {
      /*
       * Autolink...
@@ -1724,7 +2236,8 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 
       if (text)
       {
-	mmd_add(parent, type, whitespace, text, NULL);
+	*textptr = '\0';
+	mmd_add(doc, parent, type, whitespace, text, NULL);
 
 	text	   = NULL;
 	whitespace = 0;
@@ -1734,12 +2247,12 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
       lineptr  = strchr(lineptr, '>');
       *lineptr = '\0';
 
-      mmd_add(parent, MMD_TYPE_LINKED_TEXT, whitespace, url, url);
+      mmd_add(doc, parent, MMD_TYPE_LINKED_TEXT, whitespace, url, url);
 
       text = url = NULL;
       whitespace = 0;
     }
-    else if ((*lineptr == '*' || *lineptr == '_') && (!text || ispunct(lineptr[-1] & 255) || type != MMD_TYPE_NORMAL_TEXT) && type != MMD_TYPE_CODE_TEXT)
+    else if ((*lineptr == '*' || *lineptr == '_') && (!text || mmd_ispunct(lineptr[-1]) || type != MMD_TYPE_NORMAL_TEXT) && type != MMD_TYPE_CODE_TEXT)
     {
       const char *end;			/* End delimiter */
 
@@ -1757,10 +2270,12 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 	delimlen = strlen(delim);
       }
 
-      if (type == MMD_TYPE_NORMAL_TEXT && delim && ((end = strstr(lineptr + delimlen, delim)) == NULL || end == (lineptr + delimlen) || isspace(end[-1] & 255)))
+      if (type == MMD_TYPE_NORMAL_TEXT && delim && ((end = mmd_parse_find(finds, lineptr + delimlen, delim)) == NULL || end == (lineptr + delimlen) || mmd_isspace(end[-1])))
       {
 	if (!text)
-	  text = lineptr;
+	  text = textptr = lineptr;
+
+	*textptr++ = *lineptr;
 
 	delim	 = NULL;
 	delimlen = 0;
@@ -1771,9 +2286,9 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
       {
 	char save = *lineptr;
 
-	*lineptr = '\0';
+	*textptr = '\0';
 
-	mmd_add(parent, type, whitespace, text, NULL);
+	mmd_add(doc, parent, type, whitespace, text, NULL);
 
 	*lineptr   = save;
 	text	   = NULL;
@@ -1782,15 +2297,16 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 
       if (type == MMD_TYPE_NORMAL_TEXT)
       {
-	if (!strncmp(lineptr, delim, delimlen) && !isspace(lineptr[delimlen] & 255))
+	if (!strncmp(lineptr, delim, delimlen) && !mmd_isspace(lineptr[delimlen]))
 	{
-	  type = delimlen == 2 ? MMD_TYPE_STRONG_TEXT : MMD_TYPE_EMPHASIZED_TEXT;
-	  text = lineptr + delimlen;
+	  type    = delimlen == 2 ? MMD_TYPE_STRONG_TEXT : MMD_TYPE_EMPHASIZED_TEXT;
+	  text    = textptr = lineptr + delimlen;
 	  lineptr += delimlen - 1;
 	}
 	else
 	{
-	  text = lineptr;
+	  text    = lineptr;
+	  textptr = lineptr + 1;
 	}
       }
       else if (!strncmp(lineptr, delim, delimlen))
@@ -1806,19 +2322,20 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
     {
       if (text)
       {
-	*lineptr = '\0';
+	*textptr = '\0';
 
-	mmd_add(parent, type, whitespace, text, NULL);
+	mmd_add(doc, parent, type, whitespace, text, NULL);
 
 	*lineptr   = '~';
 	text	   = NULL;
 	whitespace = 0;
       }
 
-      if (!isspace(lineptr[2] & 255) && type == MMD_TYPE_NORMAL_TEXT)
+      if (!mmd_isspace(lineptr[2]) && type == MMD_TYPE_NORMAL_TEXT)
       {
-	type = MMD_TYPE_STRUCK_TEXT;
-	text = lineptr + 2;
+	type    = MMD_TYPE_STRUCK_TEXT;
+	text    = textptr = lineptr + 2;
+	lineptr ++;
       }
       else
       {
@@ -1850,10 +2367,12 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 	}
       }
 
-      if (type != MMD_TYPE_CODE_TEXT && delim && !strstr(lineptr + delimlen, delim))
+      if (type != MMD_TYPE_CODE_TEXT && delim && !mmd_parse_find(finds, lineptr + delimlen, delim))
       {
 	if (!text)
-	  text = lineptr;
+	  text = textptr = lineptr;
+
+	*textptr++ = *lineptr;
 
 	delim	 = NULL;
 	delimlen = 0;
@@ -1866,24 +2385,22 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 
 	if (!strncmp(lineptr, delim, delimlen))
 	{
-	  char	*textptr = lineptr;
-
-	  while (textptr > text && isspace(textptr[-1] & 255))
+	  while (textptr > text && mmd_isspace(textptr[-1]))
 	    textptr --;
-
-	  *textptr = '\0';
 	}
 
+	*textptr = '\0';
+
 	if (type == MMD_TYPE_CODE_TEXT)
 	{
 	  if (whitespace && !*text)
 	  {
-	    mmd_add(parent, type, 0, " ", NULL);
+	    mmd_add(doc, parent, type, 0, " ", NULL);
 	    whitespace = 0;
 	  }
 	}
 
-	mmd_add(parent, type, whitespace, text, NULL);
+	mmd_add(doc, parent, type, whitespace, text, NULL);
 
 	text	   = NULL;
 	whitespace = 0;
@@ -1903,15 +2420,15 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 	type	= MMD_TYPE_CODE_TEXT;
 	lineptr += delimlen - 1;
 
-	if (isspace(lineptr[1] & 255))
+	if (mmd_isspace(lineptr[1]))
 	{
 	  whitespace = 1;
 
-	  while (isspace(lineptr[1] & 255))
+	  while (mmd_isspace(lineptr[1]))
 	    lineptr ++;
 	}
 
-	text = lineptr + 1;
+	text = textptr = lineptr + 1;
       }
     }
     else if (!text)
@@ -1925,266 +2442,1859 @@ mmd_parse_inline(_mmd_doc_t *doc,	/* I - Document */
 	lineptr ++;
       }
 
-      text = lineptr;
+      text    = lineptr;
+      textptr = lineptr + 1;
     }
     else if (*lineptr == '\\' && lineptr[1] && lineptr[1] != '\n')
     {
      /*
-      * Escaped character...
+      * Escaped character - drop the backslash; the rest of the text is copied
+      * down behind it as it is scanned...
       */
 
-      memmove(lineptr, lineptr + 1, strlen(lineptr));
+      if (doc->linevalid > (size_t)(textptr - doc->line))
+	doc->linevalid = (size_t)(textptr - doc->line);
+
+      lineptr ++;
+      *textptr++ = *lineptr;
+    }
+    else
+    {
+      *textptr++ = *lineptr;
     }
   }
 
   if (text)
-    mmd_add(parent, type, whitespace, text, NULL);
+  {
+    *textptr = '\0';
+    mmd_add(doc, parent, type, whitespace, text, NULL);
+  }
 }
 
 
 /*
- * 'mmd_parse_link()' - Parse a link.
+ * 'mmd_parse_job()' - Parse the inline text of a job.
+ *
+ * Nodes are added to the given parent using the given memory arena, and any
+ * reference operations are logged so they can be replayed in document order.
  */
 
-static char *				/* O - End of link text */
-mmd_parse_link(_mmd_doc_t *doc,		/* I - Document */
-	       char	  *lineptr,	/* I - Pointer into line */
-	       char	  **text,	/* O - Text */
-	       char	  **url,	/* O - URL */
-	       char	  **title,	/* O - Title, if any */
-	       char	  **refname)	/* O - Reference name */
+static void
+mmd_parse_job(mmd_parser_t  *parser,	/* I - Parser */
+              _mmd_job_t    *job,	/* I - Job */
+              mmd_t         *parent,	/* I - Parent node */
+              int           whitespace,	/* I - 1 if whitespace precedes the text */
+              _mmd_arena_t  *arena,	/* I - Memory arena for nodes */
+              _mmd_refops_t *refops)	/* I - Log of reference operations */
 {
-  lineptr ++; /* skip "[" */
+  _mmd_doc_t	doc;			/* Document state for this job */
 
-  *text	   = lineptr;
-  *url	   = NULL;
-  *refname = NULL;
 
-  if (title)
-    *title = NULL;
+  memset(&doc, 0, sizeof(doc));
 
-  while (*lineptr && *lineptr != ']')
-  {
-    if (*lineptr == '\"' || *lineptr == '\'')
-    {
-      char quote = *lineptr++;
+  doc.root      = parser->doc.root;
+  doc.options   = parser->doc.options;
+  doc.arena     = arena;
+  doc.refarena  = arena;
+  doc.line      = job->text;
+  doc.linesrc   = job->linesrc;
+  doc.linevalid = job->linevalid;
+  doc.refops    = refops;
 
-      while (*lineptr && *lineptr != quote)
-	lineptr ++;
+  job->refops  = refops;
+  job->firstop = refops->num_ops;
 
-      if (!*lineptr)
-	return (lineptr);
-    }
+  mmd_parse_inline(&doc, parent, whitespace, job->text);
 
-    lineptr ++;
-  }
+  job->num_ops = refops->num_ops - job->firstop;
+}
 
-  if (!*lineptr)
-    return (lineptr);
 
-  *lineptr++ = '\0';
+/*
+ * 'mmd_parse_jobs()' - Run all of the queued inline parsing jobs.
+ *
+ * Jobs are claimed in batches by a pool of threads, each parsing into a
+ * private memory arena.  The parsed nodes are then added to their leaf
+ * blocks, the reference operations are replayed in document order, and the
+ * arenas are moved to the document.
+ */
 
-  if (*lineptr == '(')
+static void
+mmd_parse_jobs(mmd_parser_t *parser)	/* I - Parser */
+{
+  size_t	i,			/* Looping var */
+		nthreads;		/* Number of threads */
+  _mmd_pool_t	pool;			/* Pool of threads */
+  _mmd_worker_t	*workers;		/* Threads */
+  _mmd_job_t	*job;			/* Current job */
+  _mmd_refop_t	*op;			/* Current reference operation */
+#ifdef MMD_HAVE_THREADS
+  long		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+					/* Number of processors */
+#endif /* MMD_HAVE_THREADS */
+
+
+ /*
+  * Use one thread for every batch of jobs, up to the number of processors...
+  */
+
+  nthreads = parser->num_jobs / MMD_JOB_BATCH;
+
+#ifdef MMD_HAVE_THREADS
+  if (ncpus > 0 && nthreads > (size_t)ncpus)
+    nthreads = (size_t)ncpus;
+#else
+  nthreads = 1;
+#endif /* MMD_HAVE_THREADS */
+
+  if (nthreads < 1)
+    nthreads = 1;
+
+  if ((workers = calloc(nthreads, sizeof(_mmd_worker_t))) == NULL)
   {
    /*
-    * Get URL...
+    * Parse on this thread without a pool...
     */
 
-    lineptr ++;
-    *url = lineptr;
+    nthreads = 0;
+  }
 
-    while (*lineptr && *lineptr != ')')
+  pool.parser  = parser;
+  pool.nextjob = 0;
+
+  if (workers)
+  {
+#ifdef MMD_HAVE_THREADS
+    pthread_mutex_init(&pool.mutex, NULL);
+
+    for (i = 1; i < nthreads; i ++)
     {
-      if (isspace(*lineptr & 255))
-	*lineptr = '\0';
-      else if (*lineptr == '\"' || *lineptr == '\'')
-      {
-	char quote = *lineptr++;
+      workers[i].pool = &pool;
 
-	if (title)
-	  *title = lineptr;
+      if (pthread_create(&workers[i].thread, NULL, (void *(*)(void *))mmd_parse_worker, workers + i))
+        break;
+    }
 
-	while (*lineptr && *lineptr != quote)
-	  lineptr ++;
+    nthreads = i;
+#endif /* MMD_HAVE_THREADS */
 
-	if (!*lineptr)
-	  return (lineptr);
-	else if (title)
-	  *lineptr = '\0';
+    workers[0].pool = &pool;
+    mmd_parse_worker(workers);
+
+#ifdef MMD_HAVE_THREADS
+    for (i = 1; i < nthreads; i ++)
+      pthread_join(workers[i].thread, NULL);
+
+    pthread_mutex_destroy(&pool.mutex);
+#endif /* MMD_HAVE_THREADS */
+  }
+  else
+  {
+    for (i = parser->num_jobs, job = parser->jobs; i > 0; i --, job ++)
+    {
+      if (job->state != MMD_JOB_DONE)
+        mmd_parse_job(parser, job, job->parent, job->parent->last_child != NULL, parser->doc.arena, &parser->refops);
+    }
+  }
+
+ /*
+  * Add the parsed nodes to their blocks and replay the reference operations
+  * in document order...
+  */
+
+  for (i = parser->num_jobs, job = parser->jobs; i > 0; i --, job ++)
+  {
+    if (job->first)
+    {
+      mmd_t	*parent = job->parent;	/* Leaf block */
+
+      if (job->after)
+      {
+        if ((job->last->next_sibling = job->after->next_sibling) != NULL)
+          job->last->next_sibling->prev_sibling = job->last;
+        else
+          parent->last_child = job->last;
+
+        job->after->next_sibling = job->first;
+        job->first->prev_sibling = job->after;
+      }
+      else
+      {
+        if ((job->last->next_sibling = parent->first_child) != NULL)
+          parent->first_child->prev_sibling = job->last;
+        else
+          parent->last_child = job->last;
+
+        parent->first_child = job->first;
       }
+    }
 
-      lineptr ++;
+    if (job->refops)
+    {
+      size_t	count;			/* Number of operations */
+
+      for (count = job->num_ops, op = job->refops->ops + job->firstop; count > 0; count --, op ++)
+        mmd_ref_add(&parser->doc, op->node, op->name, op->url, op->title);
     }
+  }
 
-    *lineptr++ = '\0';
+ /*
+  * Move the nodes to the document and reset everything else...
+  */
+
+  for (i = 0; i < nthreads; i ++)
+  {
+    mmd_arena_merge(parser->doc.arena, &workers[i].arena);
+    free(workers[i].refops.ops);
   }
-  else if (*lineptr == '[')
+
+  free(workers);
+
+  mmd_arena_reset(&parser->jobarena);
+
+  parser->num_jobs       = 0;
+  parser->refops.num_ops = 0;
+}
+
+
+/*
+ * 'mmd_parse_line()' - Parse the next line of markdown.
+ */
+
+static void
+mmd_parse_line(mmd_parser_t *parser)	/* I - Parser */
+{
+  _mmd_doc_t	*doc = &parser->doc;	/* Document */
+  _mmd_filebuf_t *file = &parser->file;	/* Input buffer */
+  mmd_type_t	type;			/* Type for line */
+  char		*line,			/* Read line */
+		*linestart,		/* Start of line */
+		*lineptr,		/* Pointer into line */
+		*lineend,		/* End of line */
+		*temp;			/* Temporary pointer */
+  int		newindent;		/* New indentation */
+  int		blocks;			/* Block markup the line can start */
+
+
+  if (parser->pending)
   {
    /*
-    * Get reference...
+    * Append continuation lines to the pending block...
     */
 
-    lineptr ++;
-    *refname = lineptr;
-
-    while (*lineptr && *lineptr != ']')
+    if (mmd_has_continuation(parser->line, file, parser->stackptr->indent))
     {
-      if (isspace(*lineptr & 255))
-	*lineptr = '\0';
-      else if (*lineptr == '\\' && lineptr[1])
+      size_t	offset = parser->linelen;
+					/* Offset of continuation line */
+      char	*ptr;			/* Start of continuation line */
+
+      if ((line = mmd_read_line(parser, offset)) == NULL)
+        return;
+
+      ptr = line + offset;
+
+      if (doc->linevalid > offset)
+	doc->linevalid = offset;	/* Block text was shortened */
+
+      if (doc->linevalid == offset && file->linesrc && file->linesrc == doc->linesrc + doc->linevalid)
+	doc->linevalid += file->linevalid;
+
+      if (line[0] == '>' && *ptr == '>')
       {
-       /*
-	* Remove \
-	*/
+	memmove(ptr, ptr + 1, strlen(ptr));
+	parser->linelen --;
 
-	memmove(lineptr, lineptr + 1, strlen(lineptr));
+	if (doc->linevalid > (size_t)(ptr - line))
+	  doc->linevalid = (size_t)(ptr - line);
       }
-      else if (*lineptr == '\"' || *lineptr == '\'')
-      {
-	char quote = *lineptr++;
+      return;
+    }
 
-	if (title)
-	  *title = lineptr;
+    mmd_parse_pending(parser);
+  }
 
-	while (*lineptr && *lineptr != quote)
-	  lineptr ++;
+  if ((line = lineptr = mmd_read_line(parser, 0)) == NULL)
+    return;
 
-	if (!*lineptr)
-	  return (lineptr);
-	else
-	  *lineptr = '\0';
-      }
+  doc->linesrc   = file->linesrc;
+  doc->linevalid = file->linevalid;
+
+  if (parser->metadata)
+  {
+   /*
+    * Document metadata...
+    */
 
+    while (mmd_isspace(*lineptr))
       lineptr ++;
+
+    if (!strncmp(lineptr, "---", 3) || !strncmp(lineptr, "...", 3))
+    {
+      parser->metadata = 0;
+      return;
     }
 
-    *lineptr++ = '\0';
-    if (!**refname)
-      *refname = *text;
+    lineend = lineptr + strlen(lineptr) - 1;
+    if (lineend > lineptr && *lineend == '\n')
+      *lineend = '\0';
+
+    mmd_add(doc, parser->block, MMD_TYPE_METADATA_TEXT, 0, lineptr, NULL);
+    return;
   }
-  else if (*lineptr == ':')
+
+  DEBUG_printf("%03d	%-12s  %s", parser->stackptr->indent, mmd_type_string(parser->stackptr->parent->type) + 9, lineptr);
+      #if DEBUG
+  if (parser->stackptr->parent->type == MMD_TYPE_CODE_BLOCK)
+    DEBUG2_printf("	  blank_code=%d\n", parser->blank_code);
+      #endif /* DEBUG */
+
+  linestart = lineptr;
+
+  while (mmd_isspace(*lineptr))
+    lineptr ++;
+
+  DEBUG2_printf("	line indent=%d\n", (int)(lineptr - line));
+  DEBUG2_printf("	stackptr=%d\n", (int)(parser->stackptr - parser->stack));
+
+ /*
+  * Look up the block markup that can start with the first non-space
+  * character, so that only those constructs are checked below.  Most lines
+  * are plain paragraph text and skip all of them...
+  */
+
+  blocks = mmd_blocks[*lineptr & 255];
+
+  if (*lineptr == '>' && (lineptr - linestart) < 4)
   {
    /*
-    * Get reference definition...
+    * Block quote.  See if there is an existing blockquote...
+    */
+
+    DEBUG_printf("	 BLOCKQUOTE (stackptr=%ld)\n", parser->stackptr - parser->stack);
+
+    if (parser->stackptr == parser->stack || parser->stack[1].parent->type != MMD_TYPE_BLOCK_QUOTE)
+    {
+      parser->block		 = NULL;
+      parser->stackptr	 = parser->stack + 1;
+      parser->stackptr->parent = mmd_add(doc, doc->root, MMD_TYPE_BLOCK_QUOTE, 0, NULL, NULL);
+      parser->stackptr->indent = 2;
+      parser->stackptr->fence	 = '\0';
+    }
+
+   /*
+    * Skip whitespace after the ">"...
     */
 
-    lineptr ++;
-    while (*lineptr && isspace(*lineptr & 255))
-      lineptr ++;
+    lineptr ++;
+    if (mmd_isspace(*lineptr))
+      lineptr ++;
+
+    linestart = lineptr;
+
+    while (mmd_isspace(*lineptr))
+      lineptr ++;
+
+    blocks = mmd_blocks[*lineptr & 255];
+  }
+  else if (*lineptr != '>' && parser->stackptr > parser->stack && parser->stack[1].parent->type == MMD_TYPE_BLOCK_QUOTE && (!parser->block || *lineptr == '\n' || ((blocks & MMD_BLOCK_BREAK) && (mmd_is_chars(lineptr, '-', 3) || mmd_is_chars(lineptr, '_', 3) || mmd_is_chars(lineptr, '*', 3)))))
+  {
+   /*
+    * Not a lazy continuation so terminate this block quote...
+    */
+
+    DEBUG_puts("     Terminating BLOCKQUOTE\n");
+    parser->block    = NULL;
+    parser->stackptr = parser->stack;
+  }
+
+ /*
+  * Now handle all other markup not related to block quotes...
+  */
+
+  DEBUG2_printf("	stackptr=%d (%s), block=%p (%s)\n", (int)(parser->stackptr - parser->stack), mmd_type_string(parser->stackptr->parent->type) + 9, parser->block, parser->block ? mmd_type_string(parser->block->type) + 9 : "");
+  DEBUG2_printf("	strchr(lineptr, '|')=%p, mmd_is_table(file, stackptr->indent)=%d\n", strchr(lineptr, '|'), mmd_is_table(file, parser->stackptr->indent));
+  DEBUG2_printf("	linestart=%d, lineptr=%d\n", (int)(linestart - line), (int)(lineptr - line));
+  DEBUG2_printf("	mmd_is_chars(lineptr, '-', 1)=%d\n", (int)mmd_is_chars(lineptr, '-', 1));
+  DEBUG2_printf("	mmd_is_chars(lineptr, '=', 1)=%d\n", (int)mmd_is_chars(lineptr, '=', 1));
+
+  if ((blocks & MMD_BLOCK_FENCE) && (lineptr - line - parser->stackptr->indent) < 4 && ((parser->stackptr->parent->type != MMD_TYPE_CODE_BLOCK && !parser->stackptr->fence && mmd_is_codefence(lineptr, '\0', 0, NULL)) || (parser->stackptr->fence && mmd_is_codefence(lineptr, parser->stackptr->fence, parser->stackptr->fencelen, NULL))))
+  {
+   /*
+    * Code fence...
+    */
+
+    DEBUG2_printf("stackptr->indent=%d, fence='%c', fencelen=%d\n", parser->stackptr->indent, parser->stackptr->fence, (int)parser->stackptr->fencelen);
+
+    if (parser->stackptr->parent->type == MMD_TYPE_CODE_BLOCK)
+    {
+      DEBUG2_puts("Ending code block...\n");
+      parser->stackptr --;
+    }
+    else if (parser->stackptr < (parser->stack + sizeof(parser->stack) / sizeof(parser->stack[0]) - 1))
+    {
+      char	*language;		/* Language name, if any */
+
+      DEBUG2_printf("Starting code block with fence '%c'.\n", *lineptr);
+
+      parser->block		     = NULL;
+      parser->stackptr[1].parent   = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_CODE_BLOCK, 0, NULL, NULL);
+      parser->stackptr[1].indent   = lineptr - line;
+      parser->stackptr[1].fence    = *lineptr;
+      parser->stackptr[1].fencelen = mmd_is_codefence(lineptr, '\0', 0, &language);
+      parser->stackptr ++;
+
+      DEBUG2_printf("Code language=\"%s\"\n", language);
+
+      if (language)
+	parser->stackptr->parent->extra = mmd_arena_strdup(doc->arena, language);
+
+      parser->blank_code = 0;
+    }
+    return;
+  }
+  else if (parser->stackptr->parent->type == MMD_TYPE_CODE_BLOCK && (lineptr - line) >= parser->stackptr->indent)
+  {
+    if (line[parser->stackptr->indent] == '\n')
+    {
+      parser->blank_code ++;
+    }
+    else
+    {
+      while (parser->blank_code > 0)
+      {
+	mmd_add(doc, parser->stackptr->parent, MMD_TYPE_CODE_TEXT, 0, "\n", NULL);
+	parser->blank_code --;
+      }
+
+      mmd_add(doc, parser->stackptr->parent, MMD_TYPE_CODE_TEXT, 0, line + parser->stackptr->indent, NULL);
+    }
+    return;
+  }
+  else if (parser->stackptr->parent->type == MMD_TYPE_CODE_BLOCK && parser->stackptr->fence)
+  {
+    DEBUG2_printf("	  fence='%c'\n", parser->stackptr->fence);
+
+    if (!*lineptr)
+    {
+      parser->blank_code ++;
+    }
+    else
+    {
+      while (parser->blank_code > 0)
+      {
+	mmd_add(doc, parser->stackptr->parent, MMD_TYPE_CODE_TEXT, 0, "\n", NULL);
+	parser->blank_code --;
+      }
+
+      mmd_add(doc, parser->stackptr->parent, MMD_TYPE_CODE_TEXT, 0, lineptr, NULL);
+    }
+    return;
+  }
+  else if (!strncmp(lineptr, "---", 3) && doc->root->first_child == NULL && (doc->options & MMD_OPTION_METADATA))
+  {
+   /*
+    * Document metadata, the following lines are added until the closing
+    * "---" or "..."...
+    */
+
+    parser->block    = mmd_add(doc, doc->root, MMD_TYPE_METADATA, 0, NULL, NULL);
+    parser->metadata = 1;
+    return;
+  }
+  else if ((blocks & MMD_BLOCK_SETEXT) && parser->block && parser->block->type == MMD_TYPE_PARAGRAPH && (lineptr - linestart) < 4 && (lineptr - line) >= parser->stackptr->indent && (mmd_is_chars(lineptr, '-', 1) || mmd_is_chars(lineptr, '=', 1)))
+  {
+    int ch = *lineptr;
+
+    DEBUG_puts("     SETEXT HEADING\n");
+
+    while (*lineptr == ch)
+      lineptr ++;
+    while (mmd_isspace(*lineptr))
+      lineptr ++;
+
+    if (!*lineptr)
+    {
+      if (ch == '=')
+	parser->block->type = MMD_TYPE_HEADING_1;
+      else
+	parser->block->type = MMD_TYPE_HEADING_2;
+
+      parser->block = NULL;
+      return;
+    }
+
+    type = MMD_TYPE_PARAGRAPH;
+  }
+  else if ((blocks & MMD_BLOCK_BREAK) && (lineptr - linestart) < 4 && (mmd_is_chars(lineptr, '-', 3) || mmd_is_chars(lineptr, '_', 3) || mmd_is_chars(lineptr, '*', 3)))
+  {
+    DEBUG_puts("     THEMATIC BREAK\n");
+
+    if (line[0] == '>')
+      parser->stackptr = parser->stack + 1;
+    else
+      parser->stackptr = parser->stack;
+
+    mmd_add(doc, parser->stackptr->parent, MMD_TYPE_THEMATIC_BREAK, 0, NULL, NULL);
+      //      type  = MMD_TYPE_PARAGRAPH;
+    parser->block = NULL;
+    return;
+  }
+  else if ((blocks & MMD_BLOCK_BULLET) && (lineptr[1] == '\t' || lineptr[1] == ' '))
+  {
+   /*
+    * Bulleted list...
+    */
+
+    DEBUG_puts("     UNORDERED LIST\n");
+
+    lineptr	+= 2;
+    linestart = lineptr;
+    newindent = linestart - line;
+
+    while (mmd_isspace(*lineptr))
+      lineptr ++;
+
+    while (parser->stackptr > parser->stack && parser->stackptr->indent > newindent)
+      parser->stackptr --;
+
+    if (parser->stackptr > parser->stack && parser->stackptr->parent->type == MMD_TYPE_LIST_ITEM && parser->stackptr->indent == newindent)
+      parser->stackptr --;
+
+    if (parser->stackptr > parser->stack && parser->stackptr->parent->type == MMD_TYPE_ORDERED_LIST && parser->stackptr->indent == newindent)
+      parser->stackptr --;
+
+    if (parser->stackptr > parser->stack && parser->stackptr->parent->type == MMD_TYPE_BLOCK_QUOTE && line[0] != '>')
+      parser->stackptr --;
+
+    if (parser->stackptr->parent->type != MMD_TYPE_UNORDERED_LIST && parser->stackptr < (parser->stack + sizeof(parser->stack) / sizeof(parser->stack[0]) - 1))
+    {
+      parser->stackptr[1].parent = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_UNORDERED_LIST, 0, NULL, NULL);
+      parser->stackptr[1].indent = linestart - line;
+      parser->stackptr[1].fence  = '\0';
+      parser->stackptr ++;
+    }
+
+    if (parser->stackptr < (parser->stack + sizeof(parser->stack) / sizeof(parser->stack[0]) - 1))
+    {
+      parser->stackptr[1].parent = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_LIST_ITEM, 0, NULL, NULL);
+      parser->stackptr[1].indent = linestart - line;
+      parser->stackptr[1].fence  = '\0';
+      parser->stackptr ++;
+    }
+
+    type  = MMD_TYPE_PARAGRAPH;
+    parser->block = NULL;
+
+    if (mmd_is_chars(lineptr, '-', 3) || mmd_is_chars(lineptr, '_', 3) || mmd_is_chars(lineptr, '*', 3))
+    {
+      mmd_add(doc, parser->stackptr->parent, MMD_TYPE_THEMATIC_BREAK, 0, NULL, NULL);
+      return;
+    }
+  }
+  else if (blocks & MMD_BLOCK_ORDERED)
+  {
+   /*
+    * Ordered list?
+    */
+
+    DEBUG_puts("     ORDERED LIST?\n");
+
+    temp = lineptr + 1;
+
+    while (mmd_isdigit(*temp))
+      temp ++;
+
+    if ((*temp == '.' || *temp == ')') && (temp[1] == '\t' || temp[1] == ' '))
+    {
+     /*
+      * Yes, ordered list.
+      */
+
+      lineptr	  = temp + 2;
+      linestart = lineptr;
+      newindent = linestart - line;
+
+      while (mmd_isspace(*lineptr))
+	lineptr ++;
+
+      while (parser->stackptr > parser->stack && parser->stackptr->indent > newindent)
+	parser->stackptr --;
+
+      if (parser->stackptr->parent->type == MMD_TYPE_LIST_ITEM && parser->stackptr->indent == newindent)
+	parser->stackptr --;
+
+      if (parser->stackptr->parent->type == MMD_TYPE_UNORDERED_LIST && parser->stackptr->indent == newindent)
+	parser->stackptr --;
+
+      if (parser->stackptr->parent->type == MMD_TYPE_BLOCK_QUOTE && line[0] != '>')
+	parser->stackptr --;
+
+      if (parser->stackptr->parent->type != MMD_TYPE_ORDERED_LIST && parser->stackptr < (parser->stack + sizeof(parser->stack) / sizeof(parser->stack[0]) - 1))
+      {
+	parser->stackptr[1].parent = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_ORDERED_LIST, 0, NULL, NULL);
+	parser->stackptr[1].indent = linestart - line;
+	parser->stackptr[1].fence  = '\0';
+	parser->stackptr ++;
+      }
+
+      if (parser->stackptr < (parser->stack + sizeof(parser->stack) / sizeof(parser->stack[0]) - 1))
+      {
+	parser->stackptr[1].parent = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_LIST_ITEM, 0, NULL, NULL);
+	parser->stackptr[1].indent = linestart - line;
+	parser->stackptr[1].fence  = '\0';
+	parser->stackptr ++;
+      }
+
+      type  = MMD_TYPE_PARAGRAPH;
+      parser->block = NULL;
+    }
+    else
+    {
+     /*
+      * No, just a regular paragraph...
+      */
+
+      type = parser->block ? parser->block->type : MMD_TYPE_PARAGRAPH;
+    }
+  }
+  else if ((blocks & MMD_BLOCK_HEADING) && (lineptr - linestart) < 4)
+  {
+   /*
+    * Heading, count the number of '#' for the heading level...
+    */
+
+    DEBUG_puts("     HEADING?\n");
+
+    newindent = lineptr - line;
+    temp	= lineptr + 1;
+
+    while (*temp == '#')
+      temp ++;
+
+    if ((temp - lineptr) <= 6 && mmd_isspace(*temp))
+    {
+     /*
+      * Heading 1-6...
+      */
+
+      type  = MMD_TYPE_HEADING_1 + (temp - lineptr - 1);
+      parser->block = NULL;
+
+     /*
+      * Skip whitespace after "#"...
+      */
+
+      lineptr = temp;
+      while (mmd_isspace(*lineptr))
+	lineptr ++;
+
+      linestart = lineptr;
+
+     /*
+      * Strip trailing "#" characters and whitespace...
+      */
+
+      temp = lineptr + strlen(lineptr) - 1;
+      while (temp > lineptr && mmd_isspace(*temp))
+	*temp-- = '\0';
+      while (temp > lineptr && *temp == '#')
+	temp --;
+      if (mmd_isspace(*temp))
+      {
+	while (temp > lineptr && mmd_isspace(*temp))
+	  *temp-- = '\0';
+      }
+      else if (temp == lineptr)
+	*temp = '\0';
+
+      if (doc->linevalid > (size_t)(lineptr + strlen(lineptr) - line))
+	doc->linevalid = (size_t)(lineptr + strlen(lineptr) - line);
+
+      while (parser->stackptr > parser->stack && parser->stackptr->indent > newindent)
+	parser->stackptr --;
+
+      parser->block = mmd_add(doc, parser->stackptr->parent, type, 0, NULL, NULL);
+    }
+    else
+    {
+     /*
+      * More than 6 #'s, just treat as a paragraph...
+      */
+
+      type = MMD_TYPE_PARAGRAPH;
+    }
+  }
+  else if (parser->block && parser->block->type >= MMD_TYPE_HEADING_1 && parser->block->type <= MMD_TYPE_HEADING_6)
+  {
+    DEBUG_puts("     PARAGRAPH\n");
+
+    type  = MMD_TYPE_PARAGRAPH;
+    parser->block = NULL;
+  }
+  else if (!parser->block)
+  {
+    type = MMD_TYPE_PARAGRAPH;
+
+    if (lineptr == line && parser->stackptr->parent->type != MMD_TYPE_TABLE)
+      parser->stackptr = parser->stack;
+  }
+  else
+    type = parser->block->type;
+
+  if (!*lineptr)
+  {
+    if (parser->stackptr->parent->type == MMD_TYPE_CODE_BLOCK)
+      parser->blank_code ++;
+    else if (parser->stackptr->parent->type == MMD_TYPE_BLOCK_QUOTE && line[0] != '>')
+      parser->stackptr --;
+
+    parser->block = NULL;
+    return;
+  }
+  else if (!strcmp(lineptr, "+"))
+  {
+    if (parser->block)
+    {
+      if (parser->block->type == MMD_TYPE_LIST_ITEM)
+	parser->block = mmd_add(doc, parser->block, MMD_TYPE_PARAGRAPH, 0, NULL, NULL);
+      else if (parser->block->parent->type == MMD_TYPE_LIST_ITEM)
+	parser->block = mmd_add(doc, parser->block->parent, MMD_TYPE_PARAGRAPH, 0, NULL, NULL);
+      else
+	parser->block = NULL;
+    }
+    return;
+  }
+  else if ((doc->options & MMD_OPTION_TABLES) && strchr(lineptr, '|') && (parser->stackptr->parent->type == MMD_TYPE_TABLE || mmd_is_table(file, parser->stackptr->indent)))
+  {
+   /*
+    * Table...
+    */
+
+    int	col;			/* Current column */
+    char	*start,			/* Start of column/cell */
+	      *end;			/* End of column/cell */
+    mmd_t	*row = NULL,		/* Current row */
+	      *cell;			/* Current cell */
+
+    DEBUG2_printf("TABLE stackptr->parent=%p (%d), rows=%d\n", parser->stackptr->parent, parser->stackptr->parent->type, parser->rows);
+
+    if (parser->stackptr->parent->type != MMD_TYPE_TABLE && parser->stackptr < (parser->stack + sizeof(parser->stack) / sizeof(parser->stack[0]) - 1))
+    {
+      DEBUG2_printf("ADDING NEW TABLE to %p (%s)\n", parser->stackptr->parent, mmd_type_string(parser->stackptr->parent->type));
+
+      parser->stackptr[1].parent = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_TABLE, 0, NULL, NULL);
+      parser->stackptr[1].indent = parser->stackptr->indent;
+      parser->stackptr[1].fence  = '\0';
+      parser->stackptr ++;
+
+      parser->block = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_TABLE_HEADER, 0, NULL, NULL);
+
+      for (col = 0; col < (int)(sizeof(parser->columns) / sizeof(parser->columns[0])); col ++)
+	parser->columns[col] = MMD_TYPE_TABLE_BODY_CELL_LEFT;
+
+      parser->num_columns = 0;
+      parser->rows	    = -1;
+    }
+    else if (parser->rows > 0)
+    {
+      if (parser->rows == 1)
+	parser->block = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_TABLE_BODY, 0, NULL, NULL);
+    }
+    else
+      parser->block = NULL;
+
+    if (parser->block)
+      row = mmd_add(doc, parser->block, MMD_TYPE_TABLE_ROW, 0, NULL, NULL);
+
+    if (*lineptr == '|')
+      lineptr ++;			/* Skip leading pipe */
+
+    if ((end = lineptr + strlen(lineptr) - 1) > lineptr)
+    {
+      while ((*end == '\n' || *end == 'r') && end > lineptr)
+	end --;
+
+      if (end > lineptr && *end == '|')
+	*end = '\0';			/* Truncate trailing pipe */
+    }
+
+    for (col = 0; lineptr && *lineptr && col < (int)(sizeof(parser->columns) / sizeof(parser->columns[0])); col ++)
+    {
+     /*
+      * Get the bounds of the stackptr->parent cell...
+      */
+
+      start = lineptr;
+      if ((lineptr = strchr(lineptr + 1, '|')) != NULL)
+	*lineptr++ = '\0';
+
+      if (parser->block)
+      {
+       /*
+	* Add a cell to this row...
+	*/
+
+	if (parser->block->type == MMD_TYPE_TABLE_HEADER)
+	  cell = mmd_add(doc, row, MMD_TYPE_TABLE_HEADER_CELL, 0, NULL, NULL);
+	else
+	  cell = mmd_add(doc, row, parser->columns[col], 0, NULL, NULL);
+
+	mmd_parse_queue(parser, cell, start);
+      }
+      else
+      {
+       /*
+	* Process separator row for alignment...
+	*/
+
+	while (mmd_isspace(*start))
+	  start ++;
+
+	for (end = start + strlen(start) - 1; end > start && mmd_isspace(*end); end --)
+	  ;				/* Find the last non-space character */
+
+	if (*start == ':' && *end == ':')
+	  parser->columns[col] = MMD_TYPE_TABLE_BODY_CELL_CENTER;
+	else if (*end == ':')
+	  parser->columns[col] = MMD_TYPE_TABLE_BODY_CELL_RIGHT;
+
+	DEBUG2_printf("COLUMN %d SEPARATOR=\"%s\", TYPE=%d\n", col, start, parser->columns[col]);
+      }
+    }
+
+   /*
+    * Make sure the table is balanced...
+    */
+
+    if (col > parser->num_columns)
+    {
+      parser->num_columns = col;
+    }
+    else if (parser->block && parser->block->type != MMD_TYPE_TABLE_HEADER)
+    {
+      while (col < parser->num_columns)
+      {
+	mmd_add(doc, row, parser->columns[col], 0, NULL, NULL);
+	col ++;
+      }
+    }
+
+    parser->rows ++;
+    return;
+  }
+  else if (parser->stackptr->parent->type == MMD_TYPE_TABLE)
+  {
+    DEBUG2_puts("END TABLE\n");
+    parser->stackptr --;
+    parser->block = NULL;
+  }
+
+  if (parser->stackptr->parent->type != MMD_TYPE_CODE_BLOCK && (!parser->block || parser->block->type == MMD_TYPE_CODE_BLOCK) && (lineptr - linestart) >= (parser->stackptr->indent + 4))
+  {
+   /*
+    * Indented code block.
+    */
+
+    if (parser->stackptr->parent->type != MMD_TYPE_CODE_BLOCK && parser->stackptr < (parser->stack + sizeof(parser->stack) / sizeof(parser->stack[0]) - 1))
+    {
+      parser->stackptr[1].parent = mmd_add(doc, parser->stackptr->parent, MMD_TYPE_CODE_BLOCK, 0, NULL, NULL);
+      parser->stackptr[1].indent = parser->stackptr->indent + 4;
+      parser->stackptr[1].fence  = '\0';
+      parser->stackptr ++;
+
+      parser->blank_code = 0;
+    }
+
+    while (parser->blank_code > 0)
+    {
+      mmd_add(doc, parser->stackptr->parent, MMD_TYPE_CODE_TEXT, 0, "\n", NULL);
+      parser->blank_code --;
+    }
+
+    mmd_add(doc, parser->stackptr->parent, MMD_TYPE_CODE_TEXT, 0, line + parser->stackptr->indent, NULL);
+
+    return;
+  }
+
+  if (!parser->block || parser->block->type != type)
+  {
+    if (parser->stackptr->parent->type == MMD_TYPE_CODE_BLOCK)
+      parser->stackptr --;
+
+    parser->block = mmd_add(doc, parser->stackptr->parent, type, 0, NULL, NULL);
+  }
+
+ /*
+  * Wait for any continuation lines before parsing this...
+  */
+
+  parser->pending = lineptr;
+  parser->linelen = strlen(line);
+}
+
+
+/*
+ * 'mmd_parse_link()' - Parse a link.
+ */
+
+static char *				/* O - End of link text */
+mmd_parse_link(_mmd_doc_t *doc,		/* I - Document */
+	       char	  *lineptr,	/* I - Pointer into line */
+	       char	  **text,	/* O - Text */
+	       char	  **url,	/* O - URL */
+	       char	  **title,	/* O - Title, if any */
+	       char	  **refname)	/* O - Reference name */
+{
+  lineptr ++; /* skip "[" */
+
+  *text	   = lineptr;
+  *url	   = NULL;
+  *refname = NULL;
+
+  if (title)
+    *title = NULL;
+
+  while (*lineptr && *lineptr != ']')
+  {
+    if (*lineptr == '\"' || *lineptr == '\'')
+    {
+      char quote = *lineptr++;
+
+      while (*lineptr && *lineptr != quote)
+	lineptr ++;
+
+      if (!*lineptr)
+	return (lineptr);
+    }
+
+    lineptr ++;
+  }
+
+  if (!*lineptr)
+    return (lineptr);
+
+  *lineptr++ = '\0';
+
+  if (*lineptr == '(')
+  {
+   /*
+    * Get URL...
+    */
+
+    lineptr ++;
+    *url = lineptr;
+
+    while (*lineptr && *lineptr != ')')
+    {
+      if (mmd_isspace(*lineptr))
+	*lineptr = '\0';
+      else if (*lineptr == '\"' || *lineptr == '\'')
+      {
+	char quote = *lineptr++;
+
+	if (title)
+	  *title = lineptr;
+
+	while (*lineptr && *lineptr != quote)
+	  lineptr ++;
+
+	if (!*lineptr)
+	  return (lineptr);
+	else if (title)
+	  *lineptr = '\0';
+      }
+
+      lineptr ++;
+    }
+
+    if (*lineptr)
+      *lineptr++ = '\0';
+  }
+  else if (*lineptr == '[')
+  {
+   /*
+    * Get reference - escaped characters are copied down over the backslashes
+    * using a separate write pointer...
+    */
+
+    char *refptr;			/* Pointer into reference name */
+
+    lineptr ++;
+    *refname = refptr = lineptr;
+
+    while (*lineptr && *lineptr != ']')
+    {
+      if (mmd_isspace(*lineptr))
+      {
+	*refptr++ = '\0';
+      }
+      else if (*lineptr == '\\' && lineptr[1])
+      {
+       /*
+	* Remove \
+	*/
+
+	if (doc->linevalid > (size_t)(refptr - doc->line))
+	  doc->linevalid = (size_t)(refptr - doc->line);
+
+	lineptr ++;
+	*refptr++ = *lineptr;
+      }
+      else if (*lineptr == '\"' || *lineptr == '\'')
+      {
+	char quote = *lineptr++;
+
+	*refptr++ = quote;
+
+	if (title)
+	  *title = refptr;
+
+	while (*lineptr && *lineptr != quote)
+	  *refptr++ = *lineptr++;
+
+	if (!*lineptr)
+	{
+	  *refptr = '\0';
+	  return (lineptr);
+	}
+	else
+	  *refptr++ = '\0';
+      }
+      else
+      {
+	*refptr++ = *lineptr;
+      }
+
+      lineptr ++;
+    }
+
+    if (*lineptr)
+      lineptr ++;
+
+    *refptr = '\0';
+
+    if (!**refname)
+      *refname = *text;
+  }
+  else if (*lineptr == ':')
+  {
+   /*
+    * Get reference definition...
+    */
+
+    lineptr ++;
+    while (*lineptr && mmd_isspace(*lineptr))
+      lineptr ++;
+
+    *url = lineptr;
+
+    while (*lineptr && !mmd_isspace(*lineptr))
+      lineptr ++;
+
+    if (*lineptr)
+    {
+      *lineptr++ = '\0';
+      while (*lineptr && mmd_isspace(*lineptr))
+	lineptr ++;
+
+      if (*lineptr == '\"' || *lineptr == '\'')
+      {
+	char quote = *lineptr++;
+
+	if (title)
+	  *title = lineptr;
+
+	while (*lineptr && *lineptr != quote)
+	  lineptr ++;
+
+	if (!*lineptr)
+	  return (lineptr);
+	else
+	  *lineptr = '\0';
+      }
+    }
+
+    mmd_ref_add(doc, NULL, *text, *url, title ? *title : NULL);
+
+    *text = NULL;
+    *url  = NULL;
+
+    if (title)
+      *title = NULL;
+  }
+  else
+  {
+   /*
+    * Shortcut reference...
+    */
+
+    *refname = *text;
+  }
+
+  return (lineptr);
+}
+
+
+/*
+ * 'mmd_parse_lines()' - Parse the buffered lines of markdown.
+ *
+ * Each line is only parsed once the following line is available for the
+ * look-ahead functions, unless this is the end of the input.
+ */
+
+static void
+mmd_parse_lines(mmd_parser_t *parser,	/* I - Parser */
+                int          finish)	/* I - 1 at end of input, 0 otherwise */
+{
+  _mmd_filebuf_t *file = &parser->file;	/* Input buffer */
+
+
+  while (file->bufptr < file->bufend && (finish || mmd_has_lines(file)))
+    mmd_parse_line(parser);
+}
+
+
+/*
+ * 'mmd_parse_pending()' - Parse the inline content of the pending block.
+ */
+
+static void
+mmd_parse_pending(mmd_parser_t *parser)	/* I - Parser */
+{
+  int	queued = mmd_parse_queue(parser, parser->block, parser->pending);
+					/* Was the text queued for later? */
+
+  parser->pending = NULL;
+
+  if (!queued && parser->block->type == MMD_TYPE_PARAGRAPH && !parser->block->first_child)
+  {
+    mmd_remove(parser->block);
+    parser->block = NULL;
+  }
+}
+
+
+/*
+ * 'mmd_parse_queue()' - Queue the inline text of a leaf block for parsing.
+ *
+ * When the threads option is set, the text is copied and parsed by
+ * @link mmdParserFinish@.  Paragraphs that might not have any inline content,
+ * such as reference definitions or unmatched emphasis ("~~"), are parsed right
+ * away since an empty paragraph is removed and changes how the following lines
+ * are parsed.
+ */
+
+static int				/* O - 1 if queued, 0 if parsed now */
+mmd_parse_queue(mmd_parser_t *parser,	/* I - Parser */
+                mmd_t        *parent,	/* I - Leaf block */
+                char         *text)	/* I - Inline text */
+{
+  _mmd_doc_t	*doc = &parser->doc;	/* Document */
+  _mmd_job_t	*job;			/* New job */
+  size_t	offset = (size_t)(text - doc->line),
+					/* Offset of text in line */
+		textlen;		/* Length of text */
+  char		*ptr;			/* Pointer into text */
+
+
+  if (!(doc->options & MMD_OPTION_THREADS) || doc->cb || doc->refops)
+  {
+    mmd_parse_inline(doc, parent, parent->last_child != NULL, text);
+    return (0);
+  }
+
+  if (parser->num_jobs >= parser->alloc_jobs)
+  {
+    size_t	alloc_jobs = parser->alloc_jobs ? 2 * parser->alloc_jobs : 256;
+					/* New number of jobs */
+
+    if ((job = realloc(parser->jobs, alloc_jobs * sizeof(_mmd_job_t))) == NULL)
+    {
+      mmd_parse_inline(doc, parent, parent->last_child != NULL, text);
+      return (0);
+    }
+
+    parser->jobs       = job;
+    parser->alloc_jobs = alloc_jobs;
+  }
+
+  textlen = strlen(text) + 1;
+
+  if ((ptr = mmd_arena_alloc(&parser->jobarena, textlen)) == NULL)
+  {
+    mmd_parse_inline(doc, parent, parent->last_child != NULL, text);
+    return (0);
+  }
+
+  job = parser->jobs + parser->num_jobs;
+
+  memset(job, 0, sizeof(_mmd_job_t));
+  memcpy(ptr, text, textlen);
+
+  job->parent = parent;
+  job->after  = parent->last_child;
+  job->text   = ptr;
+
+  if (doc->linesrc && offset <= doc->linevalid)
+  {
+    job->linesrc   = doc->linesrc + offset;
+    job->linevalid = doc->linevalid - offset;
+  }
+
+  if (parser->num_jobs > 0 && job[-1].state != MMD_JOB_DONE && job[-1].parent == parent)
+  {
+   /*
+    * Parse after the previous job for this block...
+    */
+
+    job->state = MMD_JOB_CHAINED;
+  }
+  else if (parent->type == MMD_TYPE_PARAGRAPH && !parent->first_child)
+  {
+   /*
+    * Text that starts with anything other than link or emphasis markup always
+    * produces a node, so only parse those paragraphs now...
+    */
+
+    for (ptr = text; mmd_isspace(*ptr); ptr ++);
+
+    if (!*ptr || strchr("*[_`~", *ptr) || (*ptr == '!' && ptr[1] == '['))
+    {
+      mmd_parse_job(parser, job, parent, 0, doc->arena, &parser->refops);
+
+      job->state = MMD_JOB_DONE;
+      parser->num_jobs ++;
+
+      return (0);
+    }
+  }
+
+  parser->num_jobs ++;
+
+  return (1);
+}
+
+
+/*
+ * 'mmd_parse_section()' - Parse a section of a document.
+ *
+ * The section is parsed as if it ends the input, which is safe because each
+ * section but the last ends with a blank line.  The text need not be
+ * nul-terminated since the last lines are parsed from the carry buffer.
+ */
+
+static void *				/* O - Thread exit status (unused) */
+mmd_parse_section(
+    _mmd_section_t *section)		/* I - Section */
+{
+  mmd_parser_t	*parser = section->parser;
+					/* Parser */
+
+
+  if (mmd_parser_feed(parser, section->start, (size_t)(section->end - section->start), section->resident))
+    mmd_parser_flush(parser);
+
+  return (NULL);
+}
+
+
+/*
+ * 'mmd_parse_sections()' - Parse a whole document in sections using threads.
+ *
+ * The document is split before ATX headings at column 0 that follow a blank
+ * line, and each section is parsed by its own parser and thread.  Once all of
+ * the threads are done, each section is checked to make sure the section
+ * before it really ended at the top level - otherwise the section is parsed
+ * again using the parser of the section before it.  The sections are then
+ * added to the document and the reference operations are replayed in
+ * document order.
+ */
+
+static void
+mmd_parse_sections(mmd_parser_t *parser,/* I - Parser */
+                   char         *data,	/* I - Markdown text */
+                   size_t       datalen,/* I - Length of markdown text */
+                   int          resident)
+					/* I - 1 if the text is kept with the document */
+{
+  size_t	i,			/* Looping var */
+		count = 1,		/* Number of sections */
+		size;			/* Target size of sections */
+  _mmd_section_t *sections;		/* Sections */
+  char		*ptr,			/* Pointer into text */
+		*end = data + datalen,	/* End of text */
+		*line;			/* Start of line */
+  int		blank;			/* Was the previous line blank? */
+  mmd_parser_t	*current;		/* Parser for current section */
+  mmd_t		*root = parser->doc.root,
+					/* Root node */
+		*node;			/* Current node */
+#if defined(MMD_HAVE_THREADS) && !defined(MMD_SECTION_COUNT)
+  long		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+					/* Number of processors */
+#endif /* MMD_HAVE_THREADS && !MMD_SECTION_COUNT */
+
+
+#ifdef MMD_SECTION_COUNT
+  count = MMD_SECTION_COUNT;		/* Fixed number of sections for testing */
+#elif defined(MMD_HAVE_THREADS)
+  if (ncpus > 1)
+    count = (size_t)ncpus;
+#endif /* MMD_SECTION_COUNT */
+
+  if (count > datalen / MMD_SECTION_MIN)
+    count = datalen / MMD_SECTION_MIN;
+
+  if (count < 2 || (sections = calloc(count, sizeof(_mmd_section_t))) == NULL)
+  {
+    mmd_parser_feed(parser, data, datalen, resident);
+    return;
+  }
+
+ /*
+  * Find the start of each section...
+  */
+
+  size = datalen / count;
+
+  sections[0].parser = parser;
+  sections[0].start  = data;
+
+  for (i = 1; i < count; i ++)
+  {
+   /*
+    * Skip to the start of the next line, then look for a heading after a
+    * blank line...
+    */
+
+    ptr = sections[i - 1].start + size;
+
+    if (ptr >= end || (ptr = memchr(ptr, '\n', (size_t)(end - ptr))) == NULL)
+      break;
+
+    for (ptr ++, blank = 0; ptr < end; ptr = line)
+    {
+      if ((line = memchr(ptr, '\n', (size_t)(end - ptr))) == NULL)
+        line = end;
+      else
+        line ++;
+
+      if (blank && *ptr == '#')
+      {
+        char *temp = ptr + 1;		/* Pointer into heading */
+
+        while (temp < line && *temp == '#')
+          temp ++;
+
+        if ((temp - ptr) <= 6 && temp < line && (*temp == ' ' || *temp == '\t'))
+          break;
+      }
+
+      for (blank = 1; ptr < line; ptr ++)
+      {
+        if (!mmd_isspace(*ptr) && *ptr != '\n')
+        {
+          blank = 0;
+          break;
+        }
+      }
+    }
+
+    if (ptr >= end || (sections[i].parser = mmdParserNewEx(NULL, parser->doc.options)) == NULL)
+      break;
+
+    sections[i].start              = ptr;
+    sections[i].parser->doc.refops = &sections[i].parser->refops;
+    sections[i - 1].end            = ptr;
+  }
+
+  count = i;
+
+  sections[count - 1].end = end;
+
+  for (i = 0; i < count; i ++)
+    sections[i].resident = resident;
+
+  parser->doc.refops = &parser->refops;
+
+ /*
+  * Parse the sections, using the current thread for the first one...
+  */
+
+  for (i = 1; i < count; i ++)
+  {
+#ifdef MMD_HAVE_THREADS
+    if (!pthread_create(&sections[i].thread, NULL, (void *(*)(void *))mmd_parse_section, sections + i))
+    {
+      sections[i].threaded = 1;
+      continue;
+    }
+#endif /* MMD_HAVE_THREADS */
+
+    mmd_parse_section(sections + i);
+  }
+
+  mmd_parse_section(sections);
+
+#ifdef MMD_HAVE_THREADS
+  for (i = 1; i < count; i ++)
+  {
+    if (sections[i].threaded)
+      pthread_join(sections[i].thread, NULL);
+  }
+#endif /* MMD_HAVE_THREADS */
+
+ /*
+  * Check that each section starts at the top level, otherwise parse it again
+  * as part of the section before it...
+  */
+
+  for (i = 1, current = parser; i < count; i ++)
+  {
+    if (mmd_is_top_level(current))
+    {
+      current = sections[i].parser;
+      continue;
+    }
+
+    DEBUG2_printf("mmd_parse_sections: Parsing section %d again.\n", (int)i);
+
+    mmdParserDelete(sections[i].parser);
+
+    sections[i].parser = current;
+    mmd_parse_section(sections + i);
+    sections[i].parser = NULL;
+  }
+
+ /*
+  * Add the sections to the document and replay their reference operations in
+  * document order...
+  */
+
+  parser->doc.refops = NULL;
+
+  for (i = 0; i < count; i ++)
+  {
+    mmd_parser_t	*section = sections[i].parser;
+					/* Parser for section */
+    _mmd_refop_t	*op;		/* Current reference operation */
+    size_t		j;		/* Looping var */
+
+    if (!section)
+      continue;
+
+    if (section != parser)
+    {
+      mmd_t	*sroot = section->doc.root;
+					/* Root node of section */
+
+      for (node = sroot->first_child; node; node = node->next_sibling)
+        node->parent = root;
+
+      if (sroot->first_child)
+      {
+        if (root->last_child)
+        {
+          root->last_child->next_sibling   = sroot->first_child;
+          sroot->first_child->prev_sibling = root->last_child;
+        }
+        else
+          root->first_child = sroot->first_child;
+
+        root->last_child = sroot->last_child;
+      }
+
+      sroot->first_child = sroot->last_child = NULL;
+
+      mmd_arena_merge(parser->doc.arena, section->doc.arena);
+    }
+
+    for (j = section->refops.num_ops, op = section->refops.ops; j > 0; j --, op ++)
+      mmd_ref_add(&parser->doc, op->node, op->name, op->url, op->title);
+
+    section->refops.num_ops = 0;
+
+    if (section != parser)
+      mmdParserDelete(section);
+  }
+
+  free(sections);
+}
+
+
+/*
+ * 'mmd_parse_worker()' - Run inline parsing jobs on a thread.
+ */
+
+static void *				/* O - Thread exit status (unused) */
+mmd_parse_worker(_mmd_worker_t *worker)	/* I - Thread */
+{
+  _mmd_pool_t	*pool = worker->pool;	/* Pool of threads */
+  mmd_parser_t	*parser = pool->parser;	/* Parser */
+  size_t	i,			/* Looping var */
+		first,			/* First job in batch */
+		last;			/* Last job in batch */
+  _mmd_job_t	*job,			/* Current job */
+		*next;			/* Next job for the same block */
+  mmd_t		container,		/* Temporary parent for nodes */
+		*node;			/* Current node */
+
+
+  for (;;)
+  {
+   /*
+    * Claim the next batch of jobs...
+    */
+
+#ifdef MMD_HAVE_THREADS
+    pthread_mutex_lock(&pool->mutex);
+#endif /* MMD_HAVE_THREADS */
+
+    first = pool->nextjob;
+    if ((last = first + MMD_JOB_BATCH) > parser->num_jobs)
+      last = parser->num_jobs;
+    pool->nextjob = last;
+
+#ifdef MMD_HAVE_THREADS
+    pthread_mutex_unlock(&pool->mutex);
+#endif /* MMD_HAVE_THREADS */
+
+    if (first >= last)
+      break;
+
+    for (i = first, job = parser->jobs + first; i < last; i ++, job ++)
+    {
+      if (job->state != MMD_JOB_QUEUED)
+        continue;
+
+     /*
+      * Parse this job and any chained jobs into a temporary parent...
+      */
+
+      memset(&container, 0, sizeof(container));
+      container.type = job->parent->type;
+
+      next = job;
+
+      do
+      {
+        mmd_parse_job(parser, next, &container, job->after != NULL || container.first_child != NULL, &worker->arena, &worker->refops);
+        next ++;
+      }
+      while (next < (parser->jobs + parser->num_jobs) && next->state == MMD_JOB_CHAINED);
+
+      for (node = container.first_child; node; node = node->next_sibling)
+        node->parent = job->parent;
+
+      job->first = container.first_child;
+      job->last  = container.last_child;
+    }
+  }
+
+  return (NULL);
+}
+
+
+/*
+ * 'mmd_parser_carry()' - Add text to the carried over input of a parser.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+mmd_parser_carry(mmd_parser_t *parser,	/* I - Parser */
+                 const char   *data,	/* I - Text */
+                 size_t       datalen)	/* I - Length of text */
+{
+  if (!datalen && !parser->carry)
+    return (1);
+
+  if ((parser->carrylen + datalen) >= parser->carrysize)
+  {
+    size_t	size;			/* New size of buffer */
+    char	*temp;			/* New buffer */
+
+    for (size = parser->carrysize ? parser->carrysize : 1024; size <= (parser->carrylen + datalen); size *= 2)
+      ;					/* Find a size for the text and nul */
+
+    if ((temp = realloc(parser->carry, size)) == NULL)
+      return (0);
+
+    parser->carry     = temp;
+    parser->carrysize = size;
+  }
+
+  memcpy(parser->carry + parser->carrylen, data, datalen);
+  parser->carrylen += datalen;
+  parser->carry[parser->carrylen] = '\0';
+
+  return (1);
+}
+
+
+/*
+ * 'mmd_parser_feed()' - Parse a chunk of markdown text.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+mmd_parser_feed(mmd_parser_t *parser,	/* I - Parser */
+                const char   *data,	/* I - Markdown text */
+                size_t       datalen,	/* I - Length of markdown text */
+                int          resident)	/* I - 1 if the text is kept with the document */
+{
+  _mmd_filebuf_t *file = &parser->file;	/* Input buffer */
+  const char	*ptr;			/* Pointer into text */
+  size_t	bytes;			/* Bytes to carry over */
+
+
+  if (parser->carrylen > 0)
+  {
+   /*
+    * Complete the carried over line, then continue with the new text...
+    */
+
+    if ((ptr = memchr(data, '\n', datalen)) != NULL)
+      bytes = (size_t)(ptr - data) + 1;
+    else
+      bytes = datalen;
+
+    if (!mmd_parser_carry(parser, data, bytes))
+      return (0);
+
+    file->bufptr       = parser->carry;
+    file->bufend       = parser->carry + parser->carrylen;
+    file->resident     = 0;
+    file->nextptr      = (char *)data + bytes;
+    file->nextend      = (char *)data + datalen;
+    file->nextresident = resident;
+  }
+  else
+  {
+   /*
+    * Parse the new text in place...
+    */
+
+    file->bufptr   = (char *)data;
+    file->bufend   = (char *)data + datalen;
+    file->resident = resident;
+    file->nextptr  = NULL;
+  }
+
+  mmd_parse_lines(parser, 0);
+
+ /*
+  * Carry over the lines that could not be parsed yet...
+  */
+
+  if (file->nextptr)
+  {
+    bytes = (size_t)(file->bufend - file->bufptr);
+
+    memmove(parser->carry, file->bufptr, bytes);
+    parser->carrylen = bytes;
+
+    if (!mmd_parser_carry(parser, file->nextptr, (size_t)(file->nextend - file->nextptr)))
+      return (0);
+  }
+  else
+  {
+    parser->carrylen = 0;
+
+    if (!mmd_parser_carry(parser, file->bufptr, (size_t)(file->bufend - file->bufptr)))
+      return (0);
+  }
+
+  file->bufptr      = file->bufend = NULL;
+  file->nextptr     = NULL;
+  file->lines[0].end = file->lines[1].end = NULL;
+
+  return (1);
+}
+
+
+/*
+ * 'mmd_parser_flush()' - Parse the carried over lines at the end of the input.
+ */
+
+static void
+mmd_parser_flush(mmd_parser_t *parser)	/* I - Parser */
+{
+  _mmd_filebuf_t *file = &parser->file;	/* Input buffer */
+
+
+  file->bufptr       = parser->carry;
+  file->bufend       = parser->carry + parser->carrylen;
+  file->resident     = 0;
+  file->nextptr      = NULL;
+  file->lines[0].end = file->lines[1].end = NULL;
+
+  mmd_parse_lines(parser, 1);
 
-    *url = lineptr;
+  if (parser->pending)
+    mmd_parse_pending(parser);
 
-    while (*lineptr && !isspace(*lineptr & 255))
-      lineptr ++;
+  parser->carrylen   = 0;
+  file->bufptr       = file->bufend = NULL;
+  file->lines[0].end = file->lines[1].end = NULL;
+}
 
-    if (*lineptr)
-    {
-      *lineptr++ = '\0';
-      while (*lineptr && isspace(*lineptr & 255))
-	lineptr ++;
 
-      if (*lineptr == '\"' || *lineptr == '\'')
-      {
-	char quote = *lineptr++;
+/*
+ * 'mmd_parser_grow()' - Grow the line buffer of a parser.
+ *
+ * The pending block text points into the line buffer, so it is moved along
+ * with the buffer.
+ */
 
-	if (title)
-	  *title = lineptr;
+static int				/* O - 1 on success, 0 on error */
+mmd_parser_grow(mmd_parser_t *parser,	/* I - Parser */
+                size_t       linesize)	/* I - Minimum size of line buffer */
+{
+  size_t	size,			/* New size of buffer */
+		pending;		/* Offset of pending text */
+  char		*temp;			/* New buffer */
 
-	while (*lineptr && *lineptr != quote)
-	  lineptr ++;
 
-	if (!*lineptr)
-	  return (lineptr);
-	else
-	  *lineptr = '\0';
-      }
-    }
+  if (linesize <= parser->linesize)
+    return (1);
 
-    mmd_ref_add(doc, NULL, *text, *url, title ? *title : NULL);
+  for (size = parser->linesize ? parser->linesize : 1024; size < linesize; size *= 2)
+    ;					/* Find a size for the line */
 
-    *text = NULL;
-    *url  = NULL;
+  pending = parser->pending ? (size_t)(parser->pending - parser->line) : 0;
 
-    if (title)
-      *title = NULL;
-  }
-  else
-  {
-   /*
-    * Shortcut reference...
-    */
+  if ((temp = realloc(parser->line, size)) == NULL)
+    return (0);
 
-    *refname = *text;
-  }
+  if (parser->pending)
+    parser->pending = temp + pending;
 
-  return (lineptr);
+  parser->line     = temp;
+  parser->linesize = size;
+  parser->doc.line = temp;
+
+  return (1);
 }
 
 
 /*
- * 'mmd_read_buffer()' - Fill the file buffer with more data from a file.
+ * 'mmd_parser_start()' - Start a new document in a parser.
  */
 
-static void
-mmd_read_buffer(_mmd_filebuf_t *file)	/* I - File buffer */
+static int				/* O - 1 on success, 0 on error */
+mmd_parser_start(mmd_parser_t *parser,	/* I - Parser */
+                 mmd_t        *root)	/* I - Root node for document or `NULL` for a new document */
 {
-  size_t	bytes;			/* Bytes read */
-
+ /*
+  * Create an empty document as needed...
+  */
 
-  if (file->bufptr && file->bufptr > file->buffer)
+  if (root)
   {
-   /*
-    * Discard previous characters in the buffer.
-    */
-
-    memmove(file->buffer, file->bufptr, file->bufend - file->bufptr);
-    file->bufend -= (file->bufptr - file->buffer);
+    parser->doc.root = root;
+    parser->created  = 0;
   }
   else
   {
-   /*
-    * Otherwise just clear the buffer...
-    */
-
-    file->bufend = file->buffer;
+    parser->doc.root = mmd_add(&parser->doc, NULL, MMD_TYPE_DOCUMENT, 0, NULL, NULL);
+    parser->created  = 1;
   }
 
-  if ((bytes = fread(file->bufend, 1, sizeof(file->buffer) - (size_t)(file->bufend - file->buffer - 1), file->fp)) > 0)
-    file->bufend += bytes;
+  parser->finished = 0;
+
+  if (!parser->doc.root || (parser->doc.arena = mmd_arena(parser->doc.root)) == NULL)
+    return (0);
+
+  parser->doc.refarena = parser->doc.arena;
+
+ /*
+  * Initialize the block stack...
+  */
 
-  *(file->bufend) = '\0';
-  file->bufptr = file->buffer;
+  parser->stackptr         = parser->stack;
+  parser->stackptr->parent = parser->doc.root;
+
+  return (1);
 }
 
 
 /*
  * 'mmd_read_line()' - Read a line from a file in a Markdown-aware way.
+ *
+ * The line is stored at the given offset in the parser's line buffer, which
+ * grows as needed.
  */
 
-static char *				/* O - Pointer to line or `NULL` on EOF */
-mmd_read_line(_mmd_filebuf_t *file,	/* I - File buffer */
-	      char	     *line,	/* I - Line buffer */
-	      size_t	     linesize)	/* I - Size of line buffer */
+static char *				/* O - Pointer to line buffer or `NULL` on EOF */
+mmd_read_line(mmd_parser_t *parser,	/* I - Parser */
+	      size_t       offset)	/* I - Offset in line buffer */
 {
+  _mmd_filebuf_t *file = &parser->file;	/* Input buffer */
   int	ch,				/* Current character */
 	column = 0;			/* Current column */
-  char	*lineptr = line,		/* Pointer into line */
-	*lineend = line + linesize - 1; /* Pointer to end of buffer */
+  char	*line,				/* Start of line */
+	*lineptr,			/* Pointer into line */
+	*lineend,			/* Pointer to end of buffer */
+	*linechanged = NULL;		/* First byte that differs from source */
+  const char *spanend;			/* End of run of plain characters */
+  size_t bytes;				/* Bytes to copy */
 
 
- /*
-  * Fill the buffer as needed...
-  */
+  if ((offset + 5) > parser->linesize && !mmd_parser_grow(parser, offset + 5))
+    return (NULL);
+
+  line    = parser->line + offset;
+  lineptr = line;
+  lineend = parser->line + parser->linesize - 1;
 
-  if (!file->bufptr || (file->bufptr >= file->bufend) || !strchr(file->bufptr, '\n'))
-    mmd_read_buffer(file);
+  file->linesrc = file->resident ? file->bufptr : NULL;
 
  /*
-  * Copy a line out of the file buffer...
+  * Copy a line out of the file buffer, a run of plain characters at a time...
   */
 
   while (file->bufptr < file->bufend)
   {
+    spanend = mmd_read_span(file->bufptr, file->bufend);
+    bytes   = (size_t)(spanend - file->bufptr);
+
+    if ((size_t)(lineend - lineptr) < (bytes + 4))
+    {
+     /*
+      * Make room for the run and an expanded tab - if we can't, the line is
+      * truncated...
+      */
+
+      size_t	used = (size_t)(lineptr - line),
+					/* Bytes used in line */
+		changed = linechanged ? (size_t)(linechanged - line) : 0;
+					/* Offset of first changed byte */
+
+      if (mmd_parser_grow(parser, (size_t)(lineptr - parser->line) + bytes + 5))
+      {
+	line    = parser->line + offset;
+	lineptr = line + used;
+	lineend = parser->line + parser->linesize - 1;
+
+	if (linechanged)
+	  linechanged = line + changed;
+      }
+    }
+
+    if (bytes > (size_t)(lineend - lineptr))
+    {
+      bytes = (size_t)(lineend - lineptr);
+
+      if (!linechanged)
+	linechanged = lineptr + bytes;
+    }
+
+    memcpy(lineptr, file->bufptr, bytes);
+    lineptr      += bytes;
+    column       += (int)bytes;
+    file->bufptr = (char *)spanend;
+
+    if (file->bufptr >= file->bufend)
+      break;
+
     ch = *(file->bufptr);
     file->bufptr ++;
 
@@ -2195,6 +4305,9 @@ mmd_read_line(_mmd_filebuf_t *file,	/* I - File buffer */
       * 4 columns per tab...
       */
 
+      if (!linechanged)
+	linechanged = lineptr;
+
       do
       {
 	column ++;
@@ -2203,24 +4316,85 @@ mmd_read_line(_mmd_filebuf_t *file,	/* I - File buffer */
       }
       while (column  & 3);
     }
-    else if (ch != '\r' && lineptr < lineend)
+    else if (ch == '\n' && lineptr < lineend)
     {
-      column ++;
       *lineptr++ = ch;
+      break;
     }
+    else
+    {
+      if (!linechanged)
+	linechanged = lineptr;
 
-    if (ch == '\n')
-      break;
+      if (ch == '\n')
+        break;
+    }
   }
 
   *lineptr = '\0';
 
+  parser->linelen   = (size_t)(lineptr - parser->line);
+  file->linevalid   = (size_t)((linechanged ? linechanged : lineptr) - line);
+  file->lines[0]     = file->lines[1];
+  file->lines[1].end = NULL;
+
+  if (file->bufptr >= file->bufend && file->nextptr)
+  {
+   /*
+    * Continue with the next buffer...
+    */
+
+    file->bufptr   = file->nextptr;
+    file->bufend   = file->nextend;
+    file->resident = file->nextresident;
+    file->nextptr  = NULL;
+  }
+
   if (file->bufptr == file->bufend && lineptr == line)
     return (NULL);
-  else if (!strchr(file->bufptr, '\n'))
-    mmd_read_buffer(file);
 
-  return (line);
+  return (parser->line);
+}
+
+
+/*
+ * 'mmd_read_span()' - Find the next newline, tab, or carriage return.
+ *
+ * Characters other than these are copied from the file buffer unchanged, so
+ * the line reader scans for them 16 bytes at a time when SSE2 is available.
+ */
+
+static const char *			/* O - Pointer to character or `end` */
+mmd_read_span(const char *ptr,		/* I - Pointer into buffer */
+              const char *end)		/* I - End of buffer */
+{
+#ifdef __SSE2__
+  const __m128i	nl = _mm_set1_epi8('\n'),
+					/* Newlines */
+		tab = _mm_set1_epi8('\t'),
+					/* Tabs */
+		cr = _mm_set1_epi8('\r');
+					/* Carriage returns */
+  __m128i	chunk;			/* 16 bytes from the buffer */
+  int		mask;			/* Matching bytes */
+
+
+  while ((end - ptr) >= 16)
+  {
+    chunk = _mm_loadu_si128((const __m128i *)ptr);
+    mask  = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, nl), _mm_cmpeq_epi8(chunk, tab)), _mm_cmpeq_epi8(chunk, cr)));
+
+    if (mask)
+      return (ptr + __builtin_ctz((unsigned)mask));
+
+    ptr += 16;
+  }
+#endif /* __SSE2__ */
+
+  while (ptr < end && *ptr != '\n' && *ptr != '\t' && *ptr != '\r')
+    ptr ++;
+
+  return (ptr);
 }
 
 
@@ -2242,70 +4416,183 @@ mmd_ref_add(_mmd_doc_t *doc,		/* I - Document */
 
   DEBUG2_printf("mmd_ref_add(doc=%p, node=%p, name=\"%s\", url=\"%s\", title=\"%s\")\n", doc, node, name, url, title);
 
+  if (doc->refops)
+  {
+   /*
+    * Parsing is running on a thread, so log the operation to replay in
+    * document order once all of the threads are done.  The strings are
+    * copied since they usually point into the current line...
+    */
+
+    _mmd_refops_t	*refops = doc->refops;
+					/* Log of reference operations */
+
+    if (refops->num_ops >= refops->alloc_ops)
+    {
+      size_t		alloc_ops = refops->alloc_ops ? 2 * refops->alloc_ops : 64;
+					/* New number of operations */
+      _mmd_refop_t	*ops;		/* New operations */
+
+      if ((ops = realloc(refops->ops, alloc_ops * sizeof(_mmd_refop_t))) == NULL)
+        return;
+
+      refops->ops       = ops;
+      refops->alloc_ops = alloc_ops;
+    }
+
+    refops->ops[refops->num_ops].node  = node;
+    refops->ops[refops->num_ops].name  = mmd_arena_strdup(doc->refarena, name);
+    refops->ops[refops->num_ops].url   = url ? mmd_arena_strdup(doc->refarena, url) : NULL;
+    refops->ops[refops->num_ops].title = title ? mmd_arena_strdup(doc->refarena, title) : NULL;
+
+    if (refops->ops[refops->num_ops].name)
+      refops->num_ops ++;
+    return;
+  }
+
   if (ref)
   {
     DEBUG2_printf("mmd_ref_add: ref=%p, ref->url=\"%s\"\n", ref, ref->url);
 
     if (!ref->url && url)
     {
-      if (node)
-	node->url = strdup(url);
+     /*
+      * Nodes share the reference URL and title strings in the document
+      * arena...
+      */
+
+      ref->url = mmd_arena_strdup(doc->refarena, url);
 
-      ref->url = strdup(url);
+      if (node)
+	node->url = ref->url;
 
       if (title)
       {
-	if (node)
-	  node->extra = strdup(title);
+	ref->title = mmd_arena_strdup(doc->refarena, title);
 
-	ref->title = strdup(title);
+	if (node)
+	  node->extra = ref->title;
       }
 
-      for (i = 0; i < ref->num_pending; i ++)
+      return;
+    }
+  }
+  else
+  {
+   /*
+    * Grow the hash table so it stays at most half full, then add the new
+    * reference...
+    */
+
+    if ((doc->num_references + 1) * 2 > doc->refhashsize)
+    {
+      size_t	hashsize = doc->refhashsize ? 2 * doc->refhashsize : 64;
+					/* New size of hash table */
+      size_t	*hash;			/* New hash table */
+
+      if ((hash = calloc(hashsize, sizeof(size_t))) == NULL)
+        return;
+
+      for (i = 0; i < doc->num_references; i ++)
       {
-	ref->pending[i]->url = strdup(url);
+        size_t h = mmd_ref_hash(doc->references[i].name) & (hashsize - 1);
 
-	if (title)
-	  ref->pending[i]->extra = strdup(title);
+        while (hash[h])
+          h = (h + 1) & (hashsize - 1);
+
+        hash[h] = i + 1;
       }
 
-      free(ref->pending);
+      free(doc->refhash);
 
-      ref->num_pending = 0;
-      ref->pending     = NULL;
-      return;
+      doc->refhash     = hash;
+      doc->refhashsize = hashsize;
+    }
+
+    if (doc->num_references >= doc->alloc_references)
+    {
+      size_t alloc_references = doc->alloc_references ? 2 * doc->alloc_references : 16;
+					/* New number of references */
+
+      if ((ref = realloc(doc->references, alloc_references * sizeof(_mmd_ref_t))) == NULL)
+        return;
+
+      doc->references       = ref;
+      doc->alloc_references = alloc_references;
     }
-  }
-  else if ((ref = realloc(doc->references, (doc->num_references + 1) * sizeof(_mmd_ref_t))) != NULL)
-  {
-    doc->references = ref;
-    ref += doc->num_references;
-    doc->num_references ++;
 
-    ref->name	     = strdup(name);
-    ref->url	     = url ? strdup(url) : NULL;
-    ref->title	     = title ? strdup(title) : NULL;
-    ref->num_pending = 0;
-    ref->pending     = NULL;
+    ref = doc->references + doc->num_references;
+
+    ref->name	       = strdup(name);
+    ref->url	       = url ? mmd_arena_strdup(doc->refarena, url) : NULL;
+    ref->title	       = title ? mmd_arena_strdup(doc->refarena, title) : NULL;
+
+    i = mmd_ref_hash(name) & (doc->refhashsize - 1);
+    while (doc->refhash[i])
+      i = (i + 1) & (doc->refhashsize - 1);
+
+    doc->refhash[i] = ++ doc->num_references;
   }
-  else
-    return;
 
   if (node)
   {
     if (ref->url)
     {
-      node->url	  = strdup(ref->url);
-      node->extra = ref->title ? strdup(ref->title) : NULL;
+      node->url	  = ref->url;
+      node->extra = ref->title;
     }
-    else if ((ref->pending = realloc(ref->pending, (ref->num_pending + 1) * sizeof(mmd_t *))) != NULL)
+    else if (!doc->cb)
     {
-      ref->pending[ref->num_pending ++] = node;
+     /*
+      * Save the link so mmdParserFinish can resolve it once the whole
+      * document has been read...
+      */
+
+      if (doc->num_pending >= doc->alloc_pending)
+      {
+        size_t		alloc_pending = doc->alloc_pending ? 2 * doc->alloc_pending : 64;
+					/* New number of links */
+        _mmd_pending_t	*pending;	/* New links */
+
+        if ((pending = realloc(doc->pending, alloc_pending * sizeof(_mmd_pending_t))) == NULL)
+          return;
+
+        doc->pending       = pending;
+        doc->alloc_pending = alloc_pending;
+      }
+
+      doc->pending[doc->num_pending].node = node;
+      doc->pending[doc->num_pending].ref  = (size_t)(ref - doc->references);
+      doc->num_pending ++;
     }
   }
 }
 
 
+/*
+ * 'mmd_ref_clear()' - Remove all references and links waiting for them.
+ *
+ * The arrays and hash table are kept for the next document.
+ */
+
+static void
+mmd_ref_clear(_mmd_doc_t *doc)		/* I - Document */
+{
+  size_t	i;			/* Looping var */
+  _mmd_ref_t	*reference;		/* Current reference */
+
+
+  for (i = doc->num_references, reference = doc->references; i > 0; i --, reference ++)
+    free(reference->name);
+
+  if (doc->refhash)
+    memset(doc->refhash, 0, doc->refhashsize * sizeof(size_t));
+
+  doc->num_references = 0;
+  doc->num_pending    = 0;
+}
+
+
 /*
  * 'mmd_ref_find()' - Find a reference...
  */
@@ -2315,16 +4602,56 @@ mmd_ref_find(_mmd_doc_t *doc,		/* I - Document */
 	     const char *name)		/* I - Reference name */
 {
   size_t	i;			/* Looping var */
+  _mmd_ref_t	*ref;			/* Current reference */
+  const char	*nameptr,		/* Pointer into name */
+		*refptr;		/* Pointer into reference name */
+
+
+  if (!doc->refhash)
+    return (NULL);
+
+  for (i = mmd_ref_hash(name) & (doc->refhashsize - 1); doc->refhash[i]; i = (i + 1) & (doc->refhashsize - 1))
+  {
+    ref = doc->references + doc->refhash[i] - 1;
+
+   /*
+    * Compare the names ignoring the case of ASCII letters, so the result does
+    * not depend on the locale...
+    */
 
+    for (nameptr = name, refptr = ref->name; *nameptr && mmd_tolower(*nameptr) == mmd_tolower(*refptr); nameptr ++, refptr ++);
 
-  for (i = 0; i < doc->num_references; i ++)
-    if (!strcasecmp(name, doc->references[i].name))
-      return (doc->references + i);
+    if (!*nameptr && !*refptr)
+      return (ref);
+  }
 
   return (NULL);
 }
 
 
+/*
+ * 'mmd_ref_hash()' - Compute the case-insensitive hash of a reference name.
+ *
+ * Only ASCII letters are folded, to match @code mmd_ref_find@.
+ */
+
+static size_t				/* O - Hash value */
+mmd_ref_hash(const char *name)		/* I - Reference name */
+{
+  size_t	hash = 2166136261U;	/* FNV-1a hash */
+
+
+  while (*name)
+  {
+    hash ^= (size_t)mmd_tolower(*name & 255);
+    hash *= 16777619U;
+    name ++;
+  }
+
+  return (hash);
+}
+
+
 /*
  * 'mmd_remove()' - Remove a node from its parent.
  */
@@ -2351,6 +4678,104 @@ mmd_remove(mmd_t *node)			/* I - Node */
 }
 
 
+/*
+ * 'mmd_scan_line()' - Make a record of how a line starts.
+ *
+ * The record describes the block markup at the start of the line so the
+ * look-ahead for continuation lines and tables doesn't need to scan the line
+ * again.
+ */
+
+static _mmd_line_t *			/* O - Line record */
+mmd_scan_line(_mmd_line_t *rec,		/* I - Line record */
+              const char  *start,	/* I - Start of line */
+              char        *end)		/* I - End of line, after the newline */
+{
+  const char	*ptr;			/* Pointer into line */
+  int		blocks;			/* Block markup the line can start */
+
+
+  rec->end        = end;
+  rec->flags      = 0;
+  rec->textoffset = 0;
+
+ /*
+  * See if this is a table divider line...
+  */
+
+  ptr = start;
+  while (*ptr && mmd_ischar(*ptr, MMD_CHAR_INDENT))
+    ptr ++;
+
+  rec->quote = (int)(ptr - start);
+
+  while (*ptr && mmd_ischar(*ptr, MMD_CHAR_TABLE))
+    ptr ++;
+
+  if (*ptr == '\r' || *ptr == '\n')
+    rec->flags |= MMD_LINE_TABLE;
+
+ /*
+  * Then look at the first non-space character...
+  */
+
+  ptr = start;
+  while (*ptr != '\n' && mmd_isspace(*ptr))
+    ptr ++;
+
+  if (*ptr == '\n' || *ptr == '\r')
+  {
+    rec->flags |= MMD_LINE_BLANK;
+  }
+  else if (*ptr == '>')
+  {
+    rec->flags |= MMD_LINE_QUOTE;
+  }
+  else if ((blocks = mmd_blocks[*ptr & 255]) != 0)
+  {
+    if ((blocks & MMD_BLOCK_BULLET) && mmd_isspace(ptr[1]))
+      rec->flags |= MMD_LINE_BREAK;	/* Bullet list item */
+
+    if (blocks & MMD_BLOCK_ORDERED)
+    {
+      while (mmd_isdigit(*ptr))
+	ptr ++;
+
+      if (*ptr == '.' || *ptr == '(')
+	rec->flags |= MMD_LINE_BREAK;	/* Ordered list item */
+
+      blocks = mmd_blocks[*ptr & 255];
+    }
+
+    if (rec->flags & MMD_LINE_BREAK)
+      return (rec);
+
+    if (((blocks & MMD_BLOCK_FENCE) && mmd_is_codefence((char *)ptr, '\0', 0, NULL)) || ((blocks & MMD_BLOCK_BREAK) && (mmd_is_chars(ptr, '-', 3) || mmd_is_chars(ptr, '_', 3) || mmd_is_chars(ptr, '*', 3))) || ((blocks & MMD_BLOCK_SETEXT) && (mmd_is_chars(ptr, '-', 1) || mmd_is_chars(ptr, '=', 1))))
+    {
+     /*
+      * Code fence, thematic break, or setext heading underline...
+      */
+
+      rec->flags |= MMD_LINE_BREAK;
+    }
+    else if (blocks & MMD_BLOCK_HEADING)
+    {
+      const char *hash = ptr;		/* Start of "#"s */
+
+      while (*ptr == '#')
+	ptr ++;
+
+      if ((ptr - hash) <= 6)
+	rec->flags |= MMD_LINE_BREAK;	/* Heading */
+    }
+  }
+
+  rec->textoffset = (int)(ptr - start);
+
+  return (rec);
+}
+
+
 #if DEBUG
 /*
  * 'mmd_type_string()' - Return a string for the specified type enumeration.
@@ -29,7 +29,10 @@ enum mmd_option_e
   MMD_OPTION_METADATA = 0x01,		/* Jekyll metadata extension */
   MMD_OPTION_TABLES = 0x02,		/* Github table extension */
   MMD_OPTION_TASKS = 0x04,		/* Github task item extension (check boxes) */
-  MMD_OPTION_ALL = 0x07			/* All supported markdown extensions */
+  MMD_OPTION_ALL = 0x07,		/* All supported markdown extensions */
+  MMD_OPTION_SPANS = 0x100,		/* Keep the source in memory and reference text in it */
+  MMD_OPTION_RUNS = 0x200,		/* Merge words with the same formatting into a single text node */
+  MMD_OPTION_THREADS = 0x400		/* Parse inline text using multiple threads */
 };
 typedef unsigned mmd_option_t;
 
@@ -72,12 +75,26 @@ typedef enum mmd_type_e
   MMD_TYPE_CHECKBOX			/* [ ] or [x] */
 } mmd_type_t;
 
+typedef enum mmd_event_e		/* Parser callback events */
+{
+  MMD_EVENT_ENTER_BLOCK,		/* Start of a block */
+  MMD_EVENT_LEAVE_BLOCK,		/* End of a block */
+  MMD_EVENT_TEXT,			/* Text, code text, or line break */
+  MMD_EVENT_LINK,			/* Linked text */
+  MMD_EVENT_IMAGE,			/* Image */
+  MMD_EVENT_CHECKBOX			/* Check box */
+} mmd_event_t;
+
 
 /*
  * Types...
  */
 
 typedef struct _mmd_s mmd_t;
+typedef struct _mmd_parser_s mmd_parser_t;
+
+typedef void (*mmd_event_cb_t)(void *cbdata, mmd_t *node, mmd_event_t event);
+					/* Parser callback function */
 
 
 /*
@@ -99,13 +116,26 @@ extern mmd_option_t mmdGetOptions(void);
 extern mmd_t        *mmdGetParent(mmd_t *node);
 extern mmd_t        *mmdGetPrevSibling(mmd_t *node);
 extern const char   *mmdGetText(mmd_t *node);
+extern const char   *mmdGetTextSpan(mmd_t *node, size_t *len);
 extern mmd_type_t   mmdGetType(mmd_t *node);
 extern const char   *mmdGetURL(mmd_t *node);
 extern int          mmdGetWhitespace(mmd_t *node);
 extern int          mmdIsBlock(mmd_t *node);
 extern mmd_t        *mmdLoad(mmd_t *root, const char *filename);
+extern mmd_t        *mmdLoadBuffer(mmd_t *root, const char *data, size_t datalen);
+extern mmd_t        *mmdLoadBufferEx(mmd_t *root, const char *data, size_t datalen, mmd_option_t options);
+extern mmd_t        *mmdLoadEx(mmd_t *root, const char *filename, mmd_option_t options);
 extern mmd_t        *mmdLoadFile(mmd_t *root, FILE *fp);
+extern mmd_t        *mmdLoadFileEx(mmd_t *root, FILE *fp, mmd_option_t options);
 extern mmd_t        *mmdLoadString(mmd_t *root, const char *s);
+extern mmd_t        *mmdLoadStringEx(mmd_t *root, const char *s, mmd_option_t options);
+extern void         mmdParserDelete(mmd_parser_t *parser);
+extern int          mmdParserFeed(mmd_parser_t *parser, const char *data, size_t datalen);
+extern mmd_t        *mmdParserFinish(mmd_parser_t *parser);
+extern mmd_parser_t *mmdParserNew(mmd_t *root);
+extern mmd_parser_t *mmdParserNewEx(mmd_t *root, mmd_option_t options);
+extern int          mmdParserReset(mmd_parser_t *parser, mmd_t *root);
+extern void         mmdParserSetCallback(mmd_parser_t *parser, mmd_event_cb_t cb, void *cbdata);
 extern void         mmdSetOptions(mmd_option_t options);
 
 #  ifdef __cplusplus
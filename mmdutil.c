@@ -6,14 +6,19 @@
  * Usage:
  *
  *     mmdutil [options] filename.md [... filenameN.md]
+ *     mmdutil [options] --batch manifest.txt
+ *     mmdutil [options] --batch-dir srcdir dstdir
  *
  * Options:
  *
+ *    --batch manifest.txt	Convert the files listed in a manifest.
+ *    --batch-dir srcdir dstdir	Convert the files in a directory tree.
  *    --cover filename.ext	Specify cover image.
  *    --css filename.css	Specify style sheet.
  *    --front filename.md	Specify frontmatter file.
  *    --help			Show usage.
  *    --man section		Produce man page output.
+ *    --stream			Write each block as it is read.
  *    --toc levels		Produce a table of contents.
  *    --version			Show version.
  *    -o filename.ext		Specify output file (default is stdout).
@@ -36,11 +41,30 @@
 #include <errno.h>
 #include <time.h>
 
+#include <sys/stat.h>
+
 #if _WIN32
+#  include <direct.h>
 #  define localtime_r(t,tm) localtime_s(tm,t)
+#  define mkdir(d,m) _mkdir(d)
+#else
+#  include <dirent.h>
+#  include <pthread.h>
+#  include <unistd.h>
+#  include <sys/uio.h>
+#  define HAVE_THREADS 1
 #endif /* _WIN32 */
 
 
+/*
+ * Constants...
+ */
+
+#define RENDER_MIN_BLOCKS	100	/* Minimum top-level blocks for threaded rendering */
+#define RENDER_CHUNKS		16	/* Number of chunks per thread */
+#define RENDER_IOV		64	/* Maximum chunks per writev() call */
+
+
 /*
  * Local types...
  */
@@ -57,25 +81,134 @@ typedef struct toc_s
   char	*heading;			/* Heading text */
 } toc_t;
 
+typedef struct stream_s
+{
+  FILE		*outfp;			/* Output file */
+  format_t	format;			/* Output format */
+  int		done;			/* Stop reading the current file? */
+  const char	*title,			/* Title */
+		*copyright,		/* Copyright */
+		*author,		/* Author */
+		*version;		/* Document version */
+  int		toc_levels,		/* Number of table of contents levels */
+		num_toc;		/* Number of table of contents entries */
+  toc_t		*toc;			/* Table of contents entries */
+} stream_t;
+
+typedef struct load_s
+{
+  int		num_files,		/* Number of files */
+		next_file;		/* Next file to load */
+  const char	**filenames;		/* Filenames */
+  mmd_t		**files;		/* Loaded files */
+  int		*errors;		/* errno values for files that failed to load */
+#ifdef HAVE_THREADS
+  pthread_mutex_t mutex;		/* Mutex for next file */
+#endif /* HAVE_THREADS */
+} load_t;
+
+typedef struct job_s
+{
+  char		*infile,		/* Input filename */
+		*outfile;		/* Output filename */
+  const char	*message,		/* Error message, if any */
+		*errfile;		/* File for error message */
+  int		error;			/* errno value for error */
+} job_t;
+
+typedef struct queue_s
+{
+  struct batch_s *batch;		/* Batch */
+  int		first,			/* First job in queue */
+		last;			/* Last job in queue plus one */
+#ifdef HAVE_THREADS
+  pthread_mutex_t mutex;		/* Mutex for queue */
+#endif /* HAVE_THREADS */
+} queue_t;
+
+typedef struct batch_s
+{
+  format_t	format;			/* Output format */
+  int		section;		/* Section number for man page output */
+  char		extension[16];		/* Output filename extension */
+  const char	*coverfile,		/* Cover image filename */
+		*cssfile,		/* CSS filename */
+		*title,			/* Title */
+		*copyright,		/* Copyright */
+		*author,		/* Author */
+		*version;		/* Document version */
+  mmd_t		*front;			/* Cover page/frontmatter */
+  int		toc_levels;		/* Number of table of contents levels */
+  int		num_jobs,		/* Number of jobs */
+		alloc_jobs;		/* Allocated jobs */
+  job_t		*jobs;			/* Jobs */
+  int		num_queues;		/* Number of queues */
+  queue_t	*queues;		/* Queues, one per thread */
+} batch_t;
+
+typedef struct chunk_s
+{
+  mmd_t		*first;			/* First top-level block */
+  int		count;			/* Number of blocks */
+  FILE		*fp;			/* Memory stream */
+  char		*buffer;		/* Rendered output */
+  size_t	bufsize;		/* Size of rendered output */
+} chunk_t;
+
+typedef struct render_s
+{
+  format_t	format;			/* Output format */
+  int		num_chunks,		/* Number of chunks */
+		next_chunk;		/* Next chunk to render */
+  chunk_t	*chunks;		/* Chunks */
+#ifdef HAVE_THREADS
+  pthread_mutex_t mutex;		/* Mutex for next chunk */
+#endif /* HAVE_THREADS */
+} render_t;
+
 
 /*
  * Local functions...
  */
 
+static int		add_toc(mmd_t *node, int toc_levels, int num_toc, toc_t **toc);
+
+static int		batch_add(batch_t *batch, const char *infile, const char *outfile);
+static int		batch_compare(job_t *a, job_t *b);
+static int		batch_dir(batch_t *batch, const char *srcdir, const char *dstdir);
+static void		batch_file(batch_t *batch, job_t *job);
+static int		batch_manifest(batch_t *batch, const char *filename);
+static int		batch_run(batch_t *batch);
+static void		*batch_thread(queue_t *queue);
+
 static int		build_toc(mmd_t *parent, int toc_levels, int num_toc, toc_t **toc);
 
-static const char	*html_anchor(const char *text);
+static const char	*html_anchor(const char *text, char *buffer, size_t bufsize);
 static void		html_block(FILE *outfp, mmd_t *parent);
 static void		html_head(FILE *outfp, const char *cssfile, const char *coverfile, const char *title, const char *copyright, const char *author, const char *version);
 static void		html_leaf(FILE *outfp, mmd_t *node);
 static void		html_puts(FILE *outfp, const char *s);
 static void		html_toc(FILE *outfp, int num_toc, toc_t *toc);
 
+static int		load_files(int num_files, const char **filenames, mmd_t **files);
+static void		*load_thread(load_t *load);
+
+static int		make_dirs(char *filename);
+
 static void		man_block(FILE *outfp, mmd_t *parent);
 static void		man_head(FILE *outfp, int section, const char *title, const char *copyright, const char *author, const char *version);
 static void		man_leaf(FILE *outfp, mmd_t *node);
 static void		man_puts(FILE *outfp, const char *s, int allcaps);
 
+static int		render_doc(FILE *outfp, mmd_t *doc, format_t format);
+#ifdef HAVE_THREADS
+static void		*render_thread(render_t *render);
+#endif /* HAVE_THREADS */
+
+static int		stream_file(const char *filename, mmd_event_cb_t cb, stream_t *data);
+static void		stream_render_cb(void *cbdata, mmd_t *node, mmd_event_t event);
+static void		stream_scan_cb(void *cbdata, mmd_t *node, mmd_event_t event);
+
 static void		usage(void);
 
 
@@ -95,16 +228,24 @@ main(int  argc,				/* I - Number of command-line arguments */
   int		section = 0;		/* Section number for man page output */
   const char	*coverfile = NULL,	/* Cover image filename */
 		*cssfile = NULL,	/* CSS filename */
+		*manifest = NULL,	/* Batch manifest filename */
+		*srcdir = NULL,		/* Batch source directory */
+		*dstdir = NULL,		/* Batch destination directory */
 		*title = NULL,		/* Title */
 		*copyright = NULL,	/* Copyright */
 		*author = NULL,		/* Author */
 		*version = NULL;	/* Document version */
   mmd_t		*front = NULL,		/* Cover page/frontmatter */
-		*files[100];		/* "Body" files */
+		**files = NULL;		/* "Body" files */
+  const char	**filenames = NULL;	/* "Body" filenames */
   int		num_files = 0,		/* Number of files */
+		alloc_files = 0,	/* Allocated filenames */
+		stream = 0,		/* Write blocks as they are read? */
 		toc_levels = 0,		/* Number of table of contents levels */
 		num_toc = 0;		/* Number of table of contents entries */
   toc_t		*toc = NULL;		/* Table of contents entries */
+  stream_t	data;			/* Streaming data */
+  batch_t	batch;			/* Batch conversion data */
 
 
  /*
@@ -115,7 +256,32 @@ main(int  argc,				/* I - Number of command-line arguments */
   {
     if (!strncmp(argv[i], "--", 2))
     {
-      if (!strcmp(argv[i], "--cover"))
+      if (!strcmp(argv[i], "--batch"))
+      {
+	i ++;
+	if (i >= argc)
+	{
+	  fputs("mmdutil: Missing manifest filename after '--batch'.\n", stderr);
+	  usage();
+	  return (1);
+	}
+
+	manifest = argv[i];
+      }
+      else if (!strcmp(argv[i], "--batch-dir"))
+      {
+	i += 2;
+	if (i >= argc)
+	{
+	  fputs("mmdutil: Missing source and destination directories after '--batch-dir'.\n", stderr);
+	  usage();
+	  return (1);
+	}
+
+	srcdir = argv[i - 1];
+	dstdir = argv[i];
+      }
+      else if (!strcmp(argv[i], "--cover"))
       {
 	i ++;
 	if (i >= argc)
@@ -181,6 +347,10 @@ main(int  argc,				/* I - Number of command-line arguments */
 
 	format = FORMAT_MAN;
       }
+      else if (!strcmp(argv[i], "--stream"))
+      {
+	stream = 1;
+      }
       else if (!strcmp(argv[i], "--toc"))
       {
 	i ++;
@@ -228,30 +398,94 @@ main(int  argc,				/* I - Number of command-line arguments */
 	}
       }
     }
-    else if (num_files < (int)(sizeof(files) / sizeof(files[0])))
+    else
     {
-      if ((files[num_files] = mmdLoad(NULL, argv[i])) == NULL)
+      if (num_files >= alloc_files)
       {
-	fprintf(stderr, "mmdutil: Unable to load \"%s\": %s\n", argv[i], strerror(errno));
-	return (1);
+        const char **temp;		/* New filenames */
+
+        alloc_files = alloc_files ? 2 * alloc_files : 16;
+
+        if ((temp = realloc(filenames, (size_t)alloc_files * sizeof(const char *))) == NULL)
+        {
+	  fputs("mmdutil: Too many input files.\n", stderr);
+	  return (1);
+        }
+
+        filenames = temp;
       }
 
-      if (!title)
-	title = mmdGetMetadata(files[num_files], "title");
-      if (!author)
-	author = mmdGetMetadata(files[num_files], "author");
-      if (!copyright)
-	copyright = mmdGetMetadata(files[num_files], "copyright");
-      if (!version)
-	version = mmdGetMetadata(files[num_files], "version");
+      filenames[num_files ++] = argv[i];
+    }
+  }
 
-      num_files ++;
+  if (manifest || srcdir)
+  {
+   /*
+    * Convert each input file to its own output file...
+    */
+
+    if (num_files > 0 || outfile || stream)
+    {
+      fputs("mmdutil: Input files, '-o', and '--stream' cannot be used with '--batch' or '--batch-dir'.\n", stderr);
+      usage();
+      return (1);
     }
-    else
+
+    if (cssfile)
     {
-      fputs("mmdutil: Too many input files.\n", stderr);
+      if ((outfp = fopen(cssfile, "r")) == NULL)
+      {
+	fprintf(stderr, "mmdutil: Unable to open \"%s\": %s\n", cssfile, strerror(errno));
+	return (1);
+      }
+
+      fclose(outfp);
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    batch.format     = format;
+    batch.section    = section;
+    batch.coverfile  = coverfile;
+    batch.cssfile    = cssfile;
+    batch.title      = title;
+    batch.copyright  = copyright;
+    batch.author     = author;
+    batch.version    = version;
+    batch.front      = front;
+    batch.toc_levels = format == FORMAT_HTML ? toc_levels : 0;
+
+    if (format == FORMAT_MAN)
+      snprintf(batch.extension, sizeof(batch.extension), "%d", section);
+    else
+      strcpy(batch.extension, "html");
+
+    if (manifest && !batch_manifest(&batch, manifest))
       return (1);
+
+    if (srcdir)
+    {
+      i = batch.num_jobs;
+
+      if (!batch_dir(&batch, srcdir, dstdir))
+	return (1);
+
+      qsort(batch.jobs + i, (size_t)(batch.num_jobs - i), sizeof(job_t), (int (*)(const void *, const void *))batch_compare);
+    }
+
+    i = batch_run(&batch);
+
+    while (batch.num_jobs > 0)
+    {
+      batch.num_jobs --;
+      free(batch.jobs[batch.num_jobs].infile);
+      free(batch.jobs[batch.num_jobs].outfile);
     }
+
+    free(batch.jobs);
+    mmdFree(front);
+
+    return (i ? 0 : 1);
   }
 
   if (num_files == 0)
@@ -260,6 +494,64 @@ main(int  argc,				/* I - Number of command-line arguments */
     return (1);
   }
 
+  if (stream)
+  {
+   /*
+    * Scan the files for metadata and headings - only the first block of each
+    * file is needed unless we are producing a table of contents...
+    */
+
+    memset(&data, 0, sizeof(data));
+    data.title      = title;
+    data.copyright  = copyright;
+    data.author     = author;
+    data.version    = version;
+    data.toc_levels = format == FORMAT_HTML ? toc_levels : 0;
+
+    for (i = 0; i < num_files; i ++)
+    {
+      if (!data.toc_levels && data.title && data.author && data.copyright && data.version)
+	break;
+
+      if (!stream_file(filenames[i], stream_scan_cb, &data))
+	return (1);
+    }
+
+    title     = data.title;
+    copyright = data.copyright;
+    author    = data.author;
+    version   = data.version;
+    num_toc   = data.num_toc;
+    toc       = data.toc;
+  }
+  else
+  {
+   /*
+    * Load the files, then get the metadata from the first file that has it...
+    */
+
+    if ((files = calloc((size_t)num_files, sizeof(mmd_t *))) == NULL)
+    {
+      fprintf(stderr, "mmdutil: Unable to load files: %s\n", strerror(errno));
+      return (1);
+    }
+
+    if (!load_files(num_files, filenames, files))
+      return (1);
+
+    for (i = 0; i < num_files; i ++)
+    {
+      if (!title)
+	title = mmdGetMetadata(files[i], "title");
+      if (!author)
+	author = mmdGetMetadata(files[i], "author");
+      if (!copyright)
+	copyright = mmdGetMetadata(files[i], "copyright");
+      if (!version)
+	version = mmdGetMetadata(files[i], "version");
+    }
+  }
+
   if (outfile)
   {
     if ((outfp = fopen(outfile, "w")) == NULL)
@@ -275,7 +567,7 @@ main(int  argc,				/* I - Number of command-line arguments */
   * Generate a table of contents...
   */
 
-  if (toc_levels > 0)
+  if (toc_levels > 0 && !stream)
   {
     for (i = 0; i < num_files; i ++)
       num_toc = build_toc(files[i], toc_levels, num_toc, &toc);
@@ -285,46 +577,651 @@ main(int  argc,				/* I - Number of command-line arguments */
   * Write everything...
   */
 
+  data.outfp  = outfp;
+  data.format = format;
+
   switch (format)
   {
     case FORMAT_HTML :
 	html_head(outfp, cssfile, coverfile, title, copyright, author, version);
 
-	if (front)
-	  html_block(outfp, front);
+	if (front)
+	  html_block(outfp, front);
+
+	if (num_toc)
+	  html_toc(outfp, num_toc, toc);
+
+	for (i = 0; i < num_files; i ++)
+	{
+	  if (!stream)
+	  {
+	    if (!render_doc(outfp, files[i], FORMAT_HTML))
+	    {
+	      fprintf(stderr, "mmdutil: Unable to write \"%s\": %s\n", outfile ? outfile : "(stdout)", strerror(errno));
+	      return (1);
+	    }
+	  }
+	  else if (!stream_file(filenames[i], stream_render_cb, &data))
+	    return (1);
+	}
+
+	fputs("	 </body>\n", outfp);
+	fputs("</html>\n", outfp);
+	break;
+
+    case FORMAT_MAN :
+	man_head(outfp, section, title, copyright, author, version);
+
+	if (front)
+	  man_block(outfp, front);
+
+	for (i = 0; i < num_files; i ++)
+	{
+	  if (!stream)
+	  {
+	    if (!render_doc(outfp, files[i], FORMAT_MAN))
+	    {
+	      fprintf(stderr, "mmdutil: Unable to write \"%s\": %s\n", outfile ? outfile : "(stdout)", strerror(errno));
+	      return (1);
+	    }
+	  }
+	  else if (stream_file(filenames[i], stream_render_cb, &data))
+	  {
+	    fputs("\n", outfp);
+	  }
+	  else
+	    return (1);
+	}
+
+	if (copyright)
+	{
+	  fputs(".SH COPYRIGHT\n", outfp);
+	  man_puts(outfp, copyright, 0);
+	  fputs("\n", outfp);
+	}
+	break;
+  }
+
+  if (ferror(outfp) | (outfp != stdout ? fclose(outfp) : fflush(outfp)))
+  {
+    fprintf(stderr, "mmdutil: Unable to write \"%s\": %s\n", outfile ? outfile : "(stdout)", strerror(errno ? errno : EIO));
+    return (1);
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'add_toc()' - Add a heading to the table of contents.
+ */
+
+static int				/* O  - Number of table of contents entries */
+add_toc(mmd_t *node,			/* I  - Heading node */
+	int   toc_levels,		/* I  - Number of levels in table of contents */
+	int   num_toc,			/* I  - Number of table of contents entries */
+	toc_t **toc)			/* IO - Table of contents entries */
+{
+  mmd_type_t	type;			/* Node type */
+  char		*heading;		/* Heading text */
+  toc_t		*temp;			/* Table of contents entry */
+
+
+  type = mmdGetType(node);
+
+  if (type < MMD_TYPE_HEADING_1 || type > MMD_TYPE_HEADING_6 || (type - MMD_TYPE_HEADING_1) >= toc_levels)
+    return (num_toc);
+
+  if ((heading = mmdCopyAllText(node)) == NULL)
+    return (num_toc);
+
+  if ((num_toc % 10) == 0)
+  {
+    if ((temp = realloc(*toc, (num_toc + 10) * sizeof(toc_t))) == NULL)
+    {
+      fputs("mmdutil: Unable to allocate memory for table of contents.\n", stderr);
+      exit(1);
+    }
+
+    *toc = temp;
+  }
+
+  temp = *toc + num_toc;
+  num_toc ++;
+
+  temp->heading = heading;
+  temp->level   = type - MMD_TYPE_HEADING_1 + 1;
+
+  return (num_toc);
+}
+
+
+/*
+ * 'batch_add()' - Add an input file to a batch.
+ *
+ * If no output filename is specified, the output filename is the input
+ * filename with its extension replaced.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+batch_add(batch_t    *batch,		/* I - Batch */
+          const char *infile,		/* I - Input filename */
+          const char *outfile)		/* I - Output filename or `NULL` */
+{
+  job_t		*job;			/* New job */
+  char		temp[1024],		/* Output filename */
+		*ext;			/* Extension in output filename */
+
+
+  if (!outfile)
+  {
+    if (strlen(infile) > (sizeof(temp) - sizeof(batch->extension) - 2))
+    {
+      fprintf(stderr, "mmdutil: Filename \"%s\" is too long.\n", infile);
+      return (0);
+    }
+
+    strcpy(temp, infile);
+
+    if ((ext = strrchr(temp, '.')) == NULL || strchr(ext, '/'))
+      ext = temp + strlen(temp);
+
+    snprintf(ext, sizeof(temp) - (size_t)(ext - temp), ".%s", batch->extension);
+    outfile = temp;
+  }
+
+  if (!strcmp(infile, outfile))
+  {
+    fprintf(stderr, "mmdutil: Output file for \"%s\" would replace it.\n", infile);
+    return (0);
+  }
+
+  if (batch->num_jobs >= batch->alloc_jobs)
+  {
+    int alloc_jobs = batch->alloc_jobs ? 2 * batch->alloc_jobs : 64;
+					/* New allocated jobs */
+
+    if ((job = realloc(batch->jobs, (size_t)alloc_jobs * sizeof(job_t))) == NULL)
+    {
+      fputs("mmdutil: Too many input files.\n", stderr);
+      return (0);
+    }
+
+    batch->jobs       = job;
+    batch->alloc_jobs = alloc_jobs;
+  }
+
+  job = batch->jobs + batch->num_jobs;
+
+  memset(job, 0, sizeof(job_t));
+
+  if ((job->infile = strdup(infile)) == NULL || (job->outfile = strdup(outfile)) == NULL)
+  {
+    free(job->infile);
+    fputs("mmdutil: Too many input files.\n", stderr);
+    return (0);
+  }
+
+  batch->num_jobs ++;
+
+  return (1);
+}
+
+
+/*
+ * 'batch_compare()' - Compare two jobs by input filename.
+ */
+
+static int				/* O - Result of comparison */
+batch_compare(job_t *a,			/* I - First job */
+              job_t *b)			/* I - Second job */
+{
+  return (strcmp(a->infile, b->infile));
+}
+
+
+/*
+ * 'batch_dir()' - Add the markdown files in a directory tree to a batch.
+ *
+ * Each "name.md" file is written to the same relative path in the
+ * destination directory with the output extension.  Hidden files and
+ * directories are skipped.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+batch_dir(batch_t    *batch,		/* I - Batch */
+          const char *srcdir,		/* I - Source directory */
+          const char *dstdir)		/* I - Destination directory */
+{
+#if _WIN32
+  (void)batch;
+  (void)srcdir;
+  (void)dstdir;
+
+  fputs("mmdutil: '--batch-dir' is not supported on this platform.\n", stderr);
+  return (0);
+
+#else
+  int		ret = 1;		/* Return value */
+  DIR		*dir;			/* Directory */
+  struct dirent	*dent;			/* Directory entry */
+  struct stat	info;			/* File information */
+  size_t	len;			/* Length of name */
+  char		src[1024],		/* Source filename */
+		dst[1024];		/* Destination filename */
+
+
+  if ((dir = opendir(srcdir)) == NULL)
+  {
+    fprintf(stderr, "mmdutil: Unable to open \"%s\": %s\n", srcdir, strerror(errno));
+    return (0);
+  }
+
+  while (ret && (dent = readdir(dir)) != NULL)
+  {
+    if (dent->d_name[0] == '.')
+      continue;
+
+    if ((size_t)snprintf(src, sizeof(src), "%s/%s", srcdir, dent->d_name) >= sizeof(src) || (size_t)snprintf(dst, sizeof(dst), "%s/%s", dstdir, dent->d_name) >= sizeof(dst))
+    {
+      fprintf(stderr, "mmdutil: Filename \"%s/%s\" is too long.\n", srcdir, dent->d_name);
+      ret = 0;
+    }
+    else if (stat(src, &info))
+    {
+      fprintf(stderr, "mmdutil: Unable to open \"%s\": %s\n", src, strerror(errno));
+      ret = 0;
+    }
+    else if (S_ISDIR(info.st_mode))
+    {
+      ret = batch_dir(batch, src, dst);
+    }
+    else if ((len = strlen(dst)) > 3 && !strcmp(dst + len - 3, ".md"))
+    {
+      if ((len - 2 + strlen(batch->extension)) >= sizeof(dst))
+      {
+	fprintf(stderr, "mmdutil: Filename \"%s\" is too long.\n", src);
+	ret = 0;
+      }
+      else
+      {
+	strcpy(dst + len - 2, batch->extension);
+	ret = batch_add(batch, src, dst);
+      }
+    }
+  }
+
+  closedir(dir);
+
+  return (ret);
+#endif /* _WIN32 */
+}
+
+
+/*
+ * 'batch_file()' - Convert one file in a batch.
+ *
+ * Errors are saved in the job so that one bad file does not stop the rest
+ * of the batch.
+ */
+
+static void
+batch_file(batch_t *batch,		/* I - Batch */
+           job_t   *job)		/* I - Job */
+{
+  mmd_t		*doc;			/* Document */
+  FILE		*outfp;			/* Output file */
+  const char	*title,			/* Title */
+		*copyright,		/* Copyright */
+		*author,		/* Author */
+		*version;		/* Document version */
+  int		i,			/* Looping var */
+		num_toc = 0;		/* Number of table of contents entries */
+  toc_t		*toc = NULL;		/* Table of contents entries */
+
+
+  if ((doc = mmdLoad(NULL, job->infile)) == NULL)
+  {
+    job->message = "Unable to load";
+    job->errfile = job->infile;
+    job->error   = errno;
+    return;
+  }
+
+  if ((outfp = fopen(job->outfile, "w")) == NULL && errno == ENOENT && make_dirs(job->outfile))
+    outfp = fopen(job->outfile, "w");
+
+  if (!outfp)
+  {
+    job->message = "Unable to create";
+    job->errfile = job->outfile;
+    job->error   = errno;
+    mmdFree(doc);
+    return;
+  }
+
+  errno = 0;
+
+  if ((title = batch->title) == NULL)
+    title = mmdGetMetadata(doc, "title");
+  if ((author = batch->author) == NULL)
+    author = mmdGetMetadata(doc, "author");
+  if ((copyright = batch->copyright) == NULL)
+    copyright = mmdGetMetadata(doc, "copyright");
+  if ((version = batch->version) == NULL)
+    version = mmdGetMetadata(doc, "version");
+
+  switch (batch->format)
+  {
+    case FORMAT_HTML :
+	html_head(outfp, batch->cssfile, batch->coverfile, title, copyright, author, version);
+
+	if (batch->front)
+	  html_block(outfp, batch->front);
+
+	if (batch->toc_levels > 0 && (num_toc = build_toc(doc, batch->toc_levels, 0, &toc)) > 0)
+	{
+	  html_toc(outfp, num_toc, toc);
+
+	  for (i = 0; i < num_toc; i ++)
+	    free(toc[i].heading);
+	}
+
+	free(toc);
+
+	html_block(outfp, doc);
+
+	fputs("	 </body>\n", outfp);
+	fputs("</html>\n", outfp);
+	break;
+
+    case FORMAT_MAN :
+	man_head(outfp, batch->section, title, copyright, author, version);
+
+	if (batch->front)
+	  man_block(outfp, batch->front);
+
+	man_block(outfp, doc);
+
+	if (copyright)
+	{
+	  fputs(".SH COPYRIGHT\n", outfp);
+	  man_puts(outfp, copyright, 0);
+	  fputs("\n", outfp);
+	}
+	break;
+  }
+
+  mmdFree(doc);
+
+  if (ferror(outfp) | fclose(outfp))
+  {
+    job->message = "Unable to write";
+    job->errfile = job->outfile;
+    job->error   = errno ? errno : EIO;
+
+    remove(job->outfile);
+  }
+}
+
+
+/*
+ * 'batch_manifest()' - Add the files listed in a manifest to a batch.
+ *
+ * Each line contains an input filename and an optional output filename,
+ * separated by a tab or, when there is no tab, by spaces.  Blank lines and
+ * lines starting with "#" are ignored.  The filename "-" reads the manifest
+ * from the standard input.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+batch_manifest(batch_t    *batch,	/* I - Batch */
+               const char *filename)	/* I - Manifest filename */
+{
+  int		ret = 1,		/* Return value */
+		linenum = 0;		/* Line number */
+  FILE		*fp;			/* Manifest file */
+  char		line[2048],		/* Line from file */
+		*infile,		/* Input filename */
+		*outfile,		/* Output filename */
+		*ptr;			/* Pointer into line */
+
+
+  if (!strcmp(filename, "-"))
+  {
+    fp = stdin;
+  }
+  else if ((fp = fopen(filename, "r")) == NULL)
+  {
+    fprintf(stderr, "mmdutil: Unable to open \"%s\": %s\n", filename, strerror(errno));
+    return (0);
+  }
+
+  while (ret && fgets(line, sizeof(line), fp))
+  {
+    linenum ++;
+
+    if (!strchr(line, '\n') && !feof(fp))
+    {
+      fprintf(stderr, "mmdutil: Line %d of \"%s\" is too long.\n", linenum, filename);
+      ret = 0;
+      break;
+    }
+
+    for (ptr = line + strlen(line); ptr > line && isspace(ptr[-1] & 255); ptr --)
+      ptr[-1] = '\0';
+
+    for (infile = line; isspace(*infile & 255); infile ++);
+
+    if (!*infile || *infile == '#')
+      continue;
+
+    if ((outfile = strchr(infile, '\t')) == NULL)
+      outfile = strchr(infile, ' ');
+
+    if (outfile)
+    {
+      for (ptr = outfile; ptr > infile && isspace(ptr[-1] & 255); ptr --);
+
+      *ptr = '\0';
+
+      for (outfile ++; isspace(*outfile & 255); outfile ++);
+    }
+
+    ret = batch_add(batch, infile, outfile);
+  }
+
+  if (fp != stdin)
+    fclose(fp);
+
+  return (ret);
+}
+
+
+/*
+ * 'batch_run()' - Convert the files in a batch using a pool of threads.
+ *
+ * Each thread starts with an equal share of the files and steals from the
+ * other threads when it runs out, so a few large files do not leave the
+ * other processors idle.  Errors are reported in the order of the files in
+ * the batch.
+ */
+
+static int				/* O - 1 if all files were converted, 0 otherwise */
+batch_run(batch_t *batch)		/* I - Batch */
+{
+  int		i,			/* Looping var */
+		num_threads = 1,	/* Number of threads */
+		num_failed = 0;		/* Number of files that failed */
+  queue_t	*queue;			/* Current queue */
+  job_t		*job;			/* Current job */
+#ifdef HAVE_THREADS
+  long		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+					/* Number of processors */
+  pthread_t	*threads = NULL;	/* Threads */
+#endif /* HAVE_THREADS */
+
+
+  if (batch->num_jobs == 0)
+    return (1);
+
+#ifdef HAVE_THREADS
+ /*
+  * Use one thread per processor, this thread being one of them...
+  */
+
+  if (ncpus > 1)
+    num_threads = ncpus < batch->num_jobs ? (int)ncpus : batch->num_jobs;
+
+  if (num_threads > 1 && (threads = calloc((size_t)num_threads - 1, sizeof(pthread_t))) == NULL)
+    num_threads = 1;
+#endif /* HAVE_THREADS */
+
+  if ((batch->queues = calloc((size_t)num_threads, sizeof(queue_t))) == NULL)
+  {
+    fprintf(stderr, "mmdutil: Unable to convert files: %s\n", strerror(errno));
+    return (0);
+  }
+
+  batch->num_queues = num_threads;
+
+  for (i = 0, queue = batch->queues; i < num_threads; i ++, queue ++)
+  {
+    queue->batch = batch;
+    queue->first = (int)((long)batch->num_jobs * i / num_threads);
+    queue->last  = (int)((long)batch->num_jobs * (i + 1) / num_threads);
+
+#ifdef HAVE_THREADS
+    pthread_mutex_init(&queue->mutex, NULL);
+#endif /* HAVE_THREADS */
+  }
+
+#ifdef HAVE_THREADS
+ /*
+  * The jobs of a thread that cannot be started are stolen by the others...
+  */
+
+  for (i = 1; i < num_threads; i ++)
+  {
+    if (pthread_create(threads + i - 1, NULL, (void *(*)(void *))batch_thread, batch->queues + i))
+      break;
+  }
+
+  num_threads = i;
+#endif /* HAVE_THREADS */
+
+  batch_thread(batch->queues);
+
+#ifdef HAVE_THREADS
+  for (i = 1; i < num_threads; i ++)
+    pthread_join(threads[i - 1], NULL);
+
+  for (i = 0; i < batch->num_queues; i ++)
+    pthread_mutex_destroy(&batch->queues[i].mutex);
+
+  free(threads);
+#endif /* HAVE_THREADS */
+
+  free(batch->queues);
+  batch->queues     = NULL;
+  batch->num_queues = 0;
+
+ /*
+  * Report the files that could not be converted...
+  */
+
+  for (i = 0, job = batch->jobs; i < batch->num_jobs; i ++, job ++)
+  {
+    if (job->message)
+    {
+      fprintf(stderr, "mmdutil: %s \"%s\": %s\n", job->message, job->errfile, strerror(job->error));
+      num_failed ++;
+    }
+  }
+
+  if (num_failed)
+    fprintf(stderr, "mmdutil: %d of %d files could not be converted.\n", num_failed, batch->num_jobs);
+
+  return (num_failed == 0);
+}
+
+
+/*
+ * 'batch_thread()' - Convert files from a queue, stealing from other queues.
+ *
+ * A thread takes jobs from the front of its own queue and, once that is
+ * empty, moves the back half of another thread's queue into its own.
+ */
+
+static void *				/* O - Thread exit status (unused) */
+batch_thread(queue_t *queue)		/* I - Queue for this thread */
+{
+  batch_t	*batch = queue->batch;	/* Batch */
+  queue_t	*victim;		/* Queue to steal from */
+  int		i,			/* Looping var */
+		self,			/* Index of this thread's queue */
+		job,			/* Current job */
+		count = 0;		/* Number of stolen jobs */
+
+
+  self = (int)(queue - batch->queues);
 
-	if (num_toc)
-	  html_toc(outfp, num_toc, toc);
+  for (;;)
+  {
+#ifdef HAVE_THREADS
+    pthread_mutex_lock(&queue->mutex);
+#endif /* HAVE_THREADS */
 
-	for (i = 0; i < num_files; i ++)
-	  html_block(outfp, files[i]);
+    job = queue->first < queue->last ? queue->first ++ : -1;
 
-	fputs("	 </body>\n", outfp);
-	fputs("</html>\n", outfp);
-	break;
+#ifdef HAVE_THREADS
+    pthread_mutex_unlock(&queue->mutex);
+#endif /* HAVE_THREADS */
 
-    case FORMAT_MAN :
-	man_head(outfp, section, title, copyright, author, version);
+    if (job < 0)
+    {
+     /*
+      * Out of jobs, steal some from the next busy queue...
+      */
 
-	if (front)
-	  man_block(outfp, front);
+      for (i = 1; i < batch->num_queues && job < 0; i ++)
+      {
+	victim = batch->queues + (self + i) % batch->num_queues;
 
-	for (i = 0; i < num_files; i ++)
-	  man_block(outfp, files[i]);
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&victim->mutex);
+#endif /* HAVE_THREADS */
 
-	if (copyright)
+	if ((count = (victim->last - victim->first + 1) / 2) > 0)
 	{
-	  fputs(".SH COPYRIGHT\n", outfp);
-	  man_puts(outfp, copyright, 0);
-	  fputs("\n", outfp);
+	  victim->last -= count;
+	  job          = victim->last;
 	}
+
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&victim->mutex);
+#endif /* HAVE_THREADS */
+      }
+
+      if (job < 0)
 	break;
-  }
 
-  if (outfp != stdout)
-    fclose(outfp);
+#ifdef HAVE_THREADS
+      pthread_mutex_lock(&queue->mutex);
+#endif /* HAVE_THREADS */
 
-  return (0);
+      queue->first = job + 1;
+      queue->last  = job + count;
+
+#ifdef HAVE_THREADS
+      pthread_mutex_unlock(&queue->mutex);
+#endif /* HAVE_THREADS */
+    }
+
+    batch_file(batch, batch->jobs + job);
+  }
+
+  return (NULL);
 }
 
 
@@ -340,35 +1237,11 @@ build_toc(mmd_t *parent,		/* I  - Parent node */
 {
   mmd_t		*node,			/* Current node */
 		*next;			/* Next node */
-  mmd_type_t	type;			/* Node type */
-  toc_t		*temp;			/* Table of contents entry */
-  int		alloc_toc = num_toc;	/* Allocated entries */
 
 
   for (node = mmdGetFirstChild(parent); node; node = next)
   {
-    type = mmdGetType(node);
-
-    if (type >= MMD_TYPE_HEADING_1 && type <= MMD_TYPE_HEADING_6 && (type - MMD_TYPE_HEADING_1) < toc_levels)
-    {
-      if (num_toc >= alloc_toc)
-      {
-	alloc_toc += 10;
-	if ((temp = realloc(*toc, alloc_toc * sizeof(toc_t))) == NULL)
-	{
-	  fputs("mmdutil: Unable to allocate memory for table of contents.\n", stderr);
-	  exit(1);
-	}
-
-	*toc = temp;
-      }
-
-      temp = *toc + num_toc;
-      num_toc ++;
-
-      temp->heading = mmdCopyAllText(node);
-      temp->level   = type - MMD_TYPE_HEADING_1 + 1;
-    }
+    num_toc = add_toc(node, toc_levels, num_toc, toc);
 
     if ((next = mmdGetNextSibling(node)) == NULL)
     {
@@ -390,13 +1263,14 @@ build_toc(mmd_t *parent,		/* I  - Parent node */
  */
 
 static const char *			/* O - Anchor string */
-html_anchor(const char *text)		/* I - Text */
+html_anchor(const char *text,		/* I - Text */
+            char       *buffer,		/* I - Buffer for anchor string */
+            size_t     bufsize)		/* I - Size of buffer */
 {
   char		*bufptr;		/* Pointer into buffer */
-  static char	buffer[1024];		/* Buffer for anchor string */
 
 
-  for (bufptr = buffer; *text && bufptr < (buffer + sizeof(buffer) - 1); text ++)
+  for (bufptr = buffer; *text && bufptr < (buffer + bufsize - 1); text ++)
   {
     if ((*text >= '0' && *text <= '9') || (*text >= 'a' && *text <= 'z') || (*text >= 'A' && *text <= 'Z') || *text == '.' || *text == '-')
       *bufptr++ = tolower(*text);
@@ -422,6 +1296,7 @@ html_block(FILE	 *outfp,		/* I - Output file */
 		*hclass = NULL;		/* HTML class, if any */
   mmd_t		*node;			/* Current child node */
   mmd_type_t	type;			/* Node type */
+  char		anchor[1024];		/* Anchor string */
 
 
   switch (type = mmdGetType(parent))
@@ -536,7 +1411,7 @@ html_block(FILE	 *outfp,		/* I - Output file */
       if (mmdGetWhitespace(node))
 	putc('-', outfp);
 
-      fputs(html_anchor(mmdGetText(node)), outfp);
+      fputs(html_anchor(mmdGetText(node), anchor, sizeof(anchor)), outfp);
     }
     fputs("\">", outfp);
   }
@@ -732,6 +1607,7 @@ html_leaf(FILE	*outfp,			/* I - Output file */
   const char	*element,		/* Encoding element, if any */
 		*text,			/* Text to write */
 		*url;			/* URL to write */
+  char		anchor[1024];		/* Anchor string */
 
 
   if (mmdGetWhitespace(node))
@@ -802,7 +1678,7 @@ html_leaf(FILE	*outfp,			/* I - Output file */
     if (!prev_url || strcmp(prev_url, url))
     {
       if (!strcmp(url, "@"))
-	fprintf(outfp, "<a href=\"#%s\"", html_anchor(text));
+	fprintf(outfp, "<a href=\"#%s\"", html_anchor(text, anchor, sizeof(anchor)));
       else
 	fprintf(outfp, "<a href=\"%s\"", url);
 
@@ -881,6 +1757,7 @@ html_toc(FILE  *outfp,			/* I - Output file */
 	 toc_t *toc)			/* I - Table of contents entries */
 {
   int	level = 1;			/* Current indentation level */
+  char	anchor[1024];			/* Anchor string */
 
 
   fputs("    <h1 class=\"title\">Table of Contents</h1>\n", outfp);
@@ -895,7 +1772,7 @@ html_toc(FILE  *outfp,			/* I - Output file */
       fprintf(outfp, "%*s</ul></li>\n", level * 2 + 4, "");
     }
 
-    fprintf(outfp, "%*s<li class=\"toc\"><a href=\"#%s\">", level * 2 + 4, "", html_anchor(toc->heading));
+    fprintf(outfp, "%*s<li class=\"toc\"><a href=\"#%s\">", level * 2 + 4, "", html_anchor(toc->heading, anchor, sizeof(anchor)));
     html_puts(outfp, toc->heading);
 
     num_toc --;
@@ -930,6 +1807,150 @@ html_toc(FILE  *outfp,			/* I - Output file */
 }
 
 
+/*
+ * 'load_files()' - Load files using a pool of threads.
+ *
+ * The files are loaded in any order, but errors are reported in the order
+ * of the files.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+load_files(int        num_files,	/* I - Number of files */
+           const char **filenames,	/* I - Filenames */
+           mmd_t      **files)		/* O - Loaded files */
+{
+  int		i,			/* Looping var */
+		num_threads = 1;	/* Number of threads */
+  load_t	load;			/* Load data */
+#ifdef HAVE_THREADS
+  long		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+					/* Number of processors */
+  pthread_t	*threads = NULL;	/* Threads */
+#endif /* HAVE_THREADS */
+
+
+  memset(&load, 0, sizeof(load));
+
+  load.num_files = num_files;
+  load.filenames = filenames;
+  load.files     = files;
+
+  if ((load.errors = calloc((size_t)num_files, sizeof(int))) == NULL)
+  {
+    fprintf(stderr, "mmdutil: Unable to load files: %s\n", strerror(errno));
+    return (0);
+  }
+
+#ifdef HAVE_THREADS
+ /*
+  * Use one thread per processor, this thread being one of them...
+  */
+
+  if (ncpus > 1)
+    num_threads = ncpus < num_files ? (int)ncpus : num_files;
+
+  if (num_threads > 1 && (threads = calloc((size_t)num_threads - 1, sizeof(pthread_t))) == NULL)
+    num_threads = 1;
+
+  pthread_mutex_init(&load.mutex, NULL);
+
+  for (i = 1; i < num_threads; i ++)
+  {
+    if (pthread_create(threads + i - 1, NULL, (void *(*)(void *))load_thread, &load))
+      break;
+  }
+
+  num_threads = i;
+#endif /* HAVE_THREADS */
+
+  load_thread(&load);
+
+#ifdef HAVE_THREADS
+  for (i = 1; i < num_threads; i ++)
+    pthread_join(threads[i - 1], NULL);
+
+  pthread_mutex_destroy(&load.mutex);
+  free(threads);
+#endif /* HAVE_THREADS */
+
+ /*
+  * Report the first file that could not be loaded...
+  */
+
+  for (i = 0; i < num_files; i ++)
+  {
+    if (!files[i])
+    {
+      fprintf(stderr, "mmdutil: Unable to load \"%s\": %s\n", filenames[i], strerror(load.errors[i]));
+      free(load.errors);
+      return (0);
+    }
+  }
+
+  free(load.errors);
+
+  return (1);
+}
+
+
+/*
+ * 'load_thread()' - Load files until there are none left.
+ */
+
+static void *				/* O - Thread exit status (unused) */
+load_thread(load_t *load)		/* I - Load data */
+{
+  int	i;				/* Current file */
+
+
+  for (;;)
+  {
+#ifdef HAVE_THREADS
+    pthread_mutex_lock(&load->mutex);
+#endif /* HAVE_THREADS */
+
+    i = load->next_file ++;
+
+#ifdef HAVE_THREADS
+    pthread_mutex_unlock(&load->mutex);
+#endif /* HAVE_THREADS */
+
+    if (i >= load->num_files)
+      break;
+
+    if ((load->files[i] = mmdLoad(NULL, load->filenames[i])) == NULL)
+      load->errors[i] = errno;
+  }
+
+  return (NULL);
+}
+
+
+/*
+ * 'make_dirs()' - Create the parent directories of a file.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+make_dirs(char *filename)		/* I - Filename */
+{
+  char	*ptr;				/* Pointer into filename */
+  int	ret = 1;			/* Return value */
+
+
+  for (ptr = strchr(filename + 1, '/'); ptr && ret; ptr = strchr(ptr + 1, '/'))
+  {
+    *ptr = '\0';
+
+    if (mkdir(filename, 0777) && errno != EEXIST)
+      ret = 0;
+
+    *ptr = '/';
+  }
+
+  return (ret);
+}
+
+
 /*
  * 'man_block()' - Write a block node as man page source.
  */
@@ -1170,6 +2191,340 @@ man_puts(FILE       *outfp,		/* I - Output file */
 }
 
 
+/*
+ * 'render_doc()' - Write the body of a document.
+ *
+ * When more than one processor is available and the document has enough
+ * top-level blocks, runs of top-level blocks are rendered into memory
+ * streams by a pool of threads and then written in order using writev().
+ */
+
+static int				/* O - 1 on success, 0 if the blocks could not be written */
+render_doc(FILE     *outfp,		/* I - Output file */
+	   mmd_t    *doc,		/* I - Document */
+	   format_t format)		/* I - Output format */
+{
+#ifdef HAVE_THREADS
+  int		i,			/* Looping var */
+		num_blocks = 0,		/* Number of top-level blocks */
+		num_threads,		/* Number of threads */
+		count,			/* Number of chunks to write */
+		ok = 1,			/* Were the chunks rendered? */
+		status = 1;		/* Were the chunks written? */
+  long		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+					/* Number of processors */
+  mmd_t		*node;			/* Current block */
+  render_t	render;			/* Render data */
+  chunk_t	*chunk;			/* Current chunk */
+  pthread_t	*threads;		/* Threads */
+  struct iovec	iov[RENDER_IOV];	/* Output vector */
+  size_t	offset = 0,		/* Offset in current chunk */
+		length;			/* Length of output vector */
+  ssize_t	bytes;			/* Bytes written */
+
+
+  for (node = mmdGetFirstChild(doc); node; node = mmdGetNextSibling(node))
+    num_blocks ++;
+
+  if (ncpus > 1 && num_blocks >= RENDER_MIN_BLOCKS)
+  {
+    memset(&render, 0, sizeof(render));
+
+    num_threads       = (int)ncpus;
+    render.format     = format;
+    render.num_chunks = num_threads * RENDER_CHUNKS;
+
+    if (render.num_chunks > num_blocks)
+      render.num_chunks = num_blocks;
+
+    if ((render.chunks = calloc((size_t)render.num_chunks, sizeof(chunk_t))) == NULL)
+      ok = 0;
+
+    if ((threads = calloc((size_t)num_threads - 1, sizeof(pthread_t))) == NULL)
+      ok = 0;
+
+   /*
+    * Split the top-level blocks into chunks with about the same number of
+    * blocks...
+    */
+
+    for (i = 0, chunk = render.chunks, node = mmdGetFirstChild(doc); ok && i < render.num_chunks; i ++, chunk ++)
+    {
+      chunk->first = node;
+      chunk->count = (int)((long)num_blocks * (i + 1) / render.num_chunks - (long)num_blocks * i / render.num_chunks);
+
+      for (count = chunk->count; count > 0; count --)
+	node = mmdGetNextSibling(node);
+
+      if ((chunk->fp = open_memstream(&chunk->buffer, &chunk->bufsize)) == NULL)
+	ok = 0;
+    }
+
+    if (ok)
+    {
+      pthread_mutex_init(&render.mutex, NULL);
+
+      for (i = 1; i < num_threads; i ++)
+      {
+	if (pthread_create(threads + i - 1, NULL, (void *(*)(void *))render_thread, &render))
+	  break;
+      }
+
+      num_threads = i;
+
+      render_thread(&render);
+
+      for (i = 1; i < num_threads; i ++)
+	pthread_join(threads[i - 1], NULL);
+
+      pthread_mutex_destroy(&render.mutex);
+    }
+
+    for (i = 0, chunk = render.chunks; render.chunks && i < render.num_chunks; i ++, chunk ++)
+    {
+      if (chunk->fp && (ferror(chunk->fp) | fclose(chunk->fp)))
+	ok = 0;
+    }
+
+    if (ok)
+    {
+     /*
+      * Write the chunks in order...
+      */
+
+      fflush(outfp);
+
+      for (chunk = render.chunks, count = render.num_chunks; count > 0;)
+      {
+	for (i = 0, length = 0; i < RENDER_IOV && i < count; i ++)
+	{
+	  iov[i].iov_base = chunk[i].buffer + (i ? 0 : offset);
+	  iov[i].iov_len  = chunk[i].bufsize - (i ? 0 : offset);
+	  length          += iov[i].iov_len;
+	}
+
+	if (!length)
+	{
+	  bytes = 0;
+	}
+	else if ((bytes = writev(fileno(outfp), iov, i)) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+
+	  status = 0;
+	  break;
+	}
+	else if (bytes == 0)
+	{
+	  errno  = EIO;
+	  status = 0;
+	  break;
+	}
+
+	while (count > 0 && (size_t)bytes >= (chunk->bufsize - offset))
+	{
+	  bytes  -= (ssize_t)(chunk->bufsize - offset);
+	  offset = 0;
+	  chunk ++;
+	  count --;
+	}
+
+	offset += (size_t)bytes;
+      }
+
+      if (status && format == FORMAT_MAN)
+	fputs("\n", outfp);
+    }
+
+    for (i = 0, chunk = render.chunks; render.chunks && i < render.num_chunks; i ++, chunk ++)
+      free(chunk->buffer);
+
+    free(render.chunks);
+    free(threads);
+
+    if (ok)
+      return (status);
+  }
+#endif /* HAVE_THREADS */
+
+  if (format == FORMAT_HTML)
+    html_block(outfp, doc);
+  else
+    man_block(outfp, doc);
+
+  return (1);
+}
+
+
+#ifdef HAVE_THREADS
+/*
+ * 'render_thread()' - Render chunks of top-level blocks.
+ */
+
+static void *				/* O - Thread exit status (unused) */
+render_thread(render_t *render)		/* I - Render data */
+{
+  int		i,			/* Current chunk */
+		count;			/* Blocks left in chunk */
+  chunk_t	*chunk;			/* Current chunk */
+  mmd_t		*node;			/* Current block */
+
+
+  for (;;)
+  {
+    pthread_mutex_lock(&render->mutex);
+
+    i = render->next_chunk ++;
+
+    pthread_mutex_unlock(&render->mutex);
+
+    if (i >= render->num_chunks)
+      break;
+
+    chunk = render->chunks + i;
+
+    for (node = chunk->first, count = chunk->count; count > 0; node = mmdGetNextSibling(node), count --)
+    {
+      if (render->format == FORMAT_HTML)
+      {
+	if (mmdIsBlock(node))
+	  html_block(chunk->fp, node);
+	else
+	  html_leaf(chunk->fp, node);
+      }
+      else if (mmdIsBlock(node))
+	man_block(chunk->fp, node);
+      else
+	man_leaf(chunk->fp, node);
+    }
+  }
+
+  return (NULL);
+}
+#endif /* HAVE_THREADS */
+
+
+/*
+ * 'stream_file()' - Read a markdown file, sending each block to a callback.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+stream_file(const char     *filename,	/* I - File to read */
+	    mmd_event_cb_t cb,		/* I - Callback function */
+	    stream_t       *data)	/* I - Streaming data */
+{
+  FILE		*fp;			/* Markdown file */
+  mmd_parser_t	*parser;		/* Markdown parser */
+  char		buffer[65536];		/* Read buffer */
+  size_t	bytes;			/* Bytes read */
+
+
+  if ((fp = fopen(filename, "r")) == NULL)
+  {
+    fprintf(stderr, "mmdutil: Unable to load \"%s\": %s\n", filename, strerror(errno));
+    return (0);
+  }
+
+  if ((parser = mmdParserNew(NULL)) == NULL)
+  {
+    fprintf(stderr, "mmdutil: Unable to load \"%s\": %s\n", filename, strerror(errno));
+    fclose(fp);
+    return (0);
+  }
+
+  mmdParserSetCallback(parser, cb, data);
+
+  data->done = 0;
+
+  while (!data->done && (bytes = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+  {
+    if (!mmdParserFeed(parser, buffer, bytes))
+    {
+      fprintf(stderr, "mmdutil: Unable to load \"%s\": %s\n", filename, strerror(errno));
+      mmdParserDelete(parser);
+      fclose(fp);
+      return (0);
+    }
+  }
+
+  fclose(fp);
+
+  if (!data->done)
+    mmdFree(mmdParserFinish(parser));
+
+  mmdParserDelete(parser);
+
+  return (1);
+}
+
+
+/*
+ * 'stream_render_cb()' - Write each top-level block as it is parsed.
+ */
+
+static void
+stream_render_cb(void        *cbdata,	/* I - Streaming data */
+		 mmd_t       *node,	/* I - Current node */
+		 mmd_event_t event)	/* I - Parser event */
+{
+  stream_t	*data = (stream_t *)cbdata;
+					/* Streaming data */
+  mmd_t		*parent;		/* Parent node */
+
+
+  if (event != MMD_EVENT_ENTER_BLOCK || (parent = mmdGetParent(node)) == NULL || mmdGetParent(parent))
+    return;
+
+  if (data->format == FORMAT_HTML)
+    html_block(data->outfp, node);
+  else
+    man_block(data->outfp, node);
+}
+
+
+/*
+ * 'stream_scan_cb()' - Collect metadata and headings from a file.
+ */
+
+static void
+stream_scan_cb(void        *cbdata,	/* I - Streaming data */
+	       mmd_t       *node,	/* I - Current node */
+	       mmd_event_t event)	/* I - Parser event */
+{
+  stream_t	*data = (stream_t *)cbdata;
+					/* Streaming data */
+  mmd_t		*parent;		/* Parent node */
+  const char	*value;			/* Metadata value */
+
+
+  if (event != MMD_EVENT_ENTER_BLOCK || (parent = mmdGetParent(node)) == NULL || mmdGetParent(parent))
+    return;
+
+  if (mmdGetType(node) == MMD_TYPE_METADATA)
+  {
+   /*
+    * Metadata is always the first block in a file, so copy the values before
+    * the block is freed...
+    */
+
+    if (!data->title && (value = mmdGetMetadata(parent, "title")) != NULL)
+      data->title = strdup(value);
+    if (!data->author && (value = mmdGetMetadata(parent, "author")) != NULL)
+      data->author = strdup(value);
+    if (!data->copyright && (value = mmdGetMetadata(parent, "copyright")) != NULL)
+      data->copyright = strdup(value);
+    if (!data->version && (value = mmdGetMetadata(parent, "version")) != NULL)
+      data->version = strdup(value);
+  }
+
+  if (data->toc_levels > 0)
+    data->num_toc = add_toc(node, data->toc_levels, data->num_toc, &data->toc);
+  else
+    data->done = 1;
+}
+
+
 /*
  * 'usage()' - Show program usage.
  */
@@ -1178,12 +2533,17 @@ static void
 usage(void)
 {
   puts("Usage: mmdutil [options] filename.md [... filenameN.md]");
+  puts("       mmdutil [options] --batch manifest.txt");
+  puts("       mmdutil [options] --batch-dir srcdir dstdir");
   puts("Options:");
+  puts("  --batch manifest.txt	      Convert the files listed in a manifest.");
+  puts("  --batch-dir srcdir dstdir   Convert the files in a directory tree.");
   puts("  --cover filename.jpg	      Specify cover image.");
   puts("  --css filename.css	      Specify style sheet.");
   puts("  --front filename.md	      Specify frontmatter file.");
   puts("  --help		      Show usage.");
   puts("  --man section		      Produce man page output.");
+  puts("  --stream		      Write each block as it is read.");
   puts("  --toc levels		      Produce a table of contents.");
   puts("  --version		      Show version.");
   puts("  -o filename.html	      Specify output filename.");
@@ -5,8 +5,12 @@
  *
  * Usage:
  *
- *     ./testmmd [--ext {all,none}] [--help] [--only-body] [--spec]
- *               [-o filename.html] filename.md
+ *     ./testmmd [--buffer] [--ext {all,none}] [--feed] [--help] [--only-body] [--reset]
+ *               [--runs] [--spans] [--spec] [--threads] [-o filename.html] filename.md
+ *
+ * The "--feed" option loads the file with the push parser.  The "--reset"
+ * option does the same after feeding a partial document and discarding it
+ * with mmdParserReset().
  *
  * Copyright © 2017-2022 by Michael R Sweet.
  *
@@ -39,8 +43,10 @@ static int		spec_mode = 0;	/* Output HTML according to the CommonMark spec */
 static void		add_spec_text(char *dst, const char *src, size_t dstsize);
 static void		indent_puts(FILE *logfile, const char *text, int cursor);
 static int		is_equal(const char *generated, const char *expected, int *failed_at);
+static mmd_t		*load_buffer(const char *filename, mmd_option_t options);
+static mmd_t		*load_feed(const char *filename, mmd_option_t options, int reset);
 static const char	*make_anchor(const char *text);
-static int		run_spec(const char *filename, FILE *logfile);
+static int		run_spec(const char *filename, FILE *logfile, mmd_option_t options);
 static void		usage(void);
 static void		write_block(FILE *fp, mmd_t *parent);
 static void		write_html(FILE *fp, const char *s);
@@ -57,6 +63,10 @@ main(int  argc,				/* I - Number of command-line arguments */
 {
   int		i;			/* Looping var */
   int		only_body = 0;		/* Only output body content? */
+  int		buffer = 0;		/* Load the file from a memory buffer? */
+  int		feed = 0;		/* Use the push parser? (2 = reset) */
+  mmd_option_t	options = MMD_OPTION_ALL;
+					/* Markdown options */
   FILE		*fp = stdout;		/* Output file */
   const char	*filename = NULL;	/* File to load */
   mmd_t         *doc;                   /* Document */
@@ -65,7 +75,11 @@ main(int  argc,				/* I - Number of command-line arguments */
 
   for (i = 1; i < argc; i ++)
   {
-    if (!strcmp(argv[i], "--ext"))
+    if (!strcmp(argv[i], "--buffer"))
+    {
+      buffer = 1;
+    }
+    else if (!strcmp(argv[i], "--ext"))
     {
       i ++;
       if (i >= argc)
@@ -76,11 +90,11 @@ main(int  argc,				/* I - Number of command-line arguments */
 
       if (!strcmp(argv[i], "all"))
       {
-        mmdSetOptions(MMD_OPTION_ALL);
+        options |= MMD_OPTION_ALL;
       }
       else if (!strcmp(argv[i], "none"))
       {
-        mmdSetOptions(MMD_OPTION_NONE);
+        options &= ~MMD_OPTION_ALL;
       }
       else
       {
@@ -88,6 +102,11 @@ main(int  argc,				/* I - Number of command-line arguments */
         return (1);
       }
     }
+    else if (!strcmp(argv[i], "--feed"))
+    {
+      if (!feed)
+        feed = 1;
+    }
     else if (!strcmp(argv[i], "--help"))
     {
       usage();
@@ -112,10 +131,26 @@ main(int  argc,				/* I - Number of command-line arguments */
         return (1);
       }
     }
+    else if (!strcmp(argv[i], "--reset"))
+    {
+      feed = 2;
+    }
+    else if (!strcmp(argv[i], "--runs"))
+    {
+      options |= MMD_OPTION_RUNS;
+    }
+    else if (!strcmp(argv[i], "--spans"))
+    {
+      options |= MMD_OPTION_SPANS;
+    }
     else if (!strcmp(argv[i], "--spec"))
     {
       spec_mode = 1;
     }
+    else if (!strcmp(argv[i], "--threads"))
+    {
+      options |= MMD_OPTION_THREADS;
+    }
     else if (argv[i][0] == '-')
     {
       printf("Unknown option '%s'.\n", argv[i]);
@@ -132,11 +167,15 @@ main(int  argc,				/* I - Number of command-line arguments */
   }
 
   if (spec_mode)
-    return (run_spec(filename, fp));
+    return (run_spec(filename, fp, options));
+  else if (feed)
+    doc = load_feed(filename, options, feed == 2);
+  else if (buffer)
+    doc = load_buffer(filename, options);
   else if (filename)
-    doc = mmdLoad(NULL, filename);
+    doc = mmdLoadEx(NULL, filename, options);
   else
-    doc = mmdLoadFile(NULL, stdin);
+    doc = mmdLoadFileEx(NULL, stdin, options);
 
   if (!doc)
   {
@@ -375,6 +414,118 @@ is_equal(const char *generated,		/* I - Generated string */
 }
 
 
+/*
+ * 'load_buffer()' - Load a markdown file from a memory buffer.
+ *
+ * The buffer is exactly the size of the file and is not nul-terminated, so
+ * reads past the end of the text can be found with the address sanitizer.
+ */
+
+static mmd_t *				/* O - Document or `NULL` on error */
+load_buffer(const char   *filename,	/* I - File to load or `NULL` for stdin */
+            mmd_option_t options)	/* I - Markdown options */
+{
+  FILE		*fp;			/* File to read from */
+  mmd_t		*doc = NULL;		/* Document */
+  char		*data = NULL,		/* File data */
+		*temp;			/* New file data */
+  size_t	datalen = 0,		/* Length of file data */
+		datasize = 0,		/* Size of file data buffer */
+		bytes;			/* Bytes read */
+
+
+  if (!filename)
+    fp = stdin;
+  else if ((fp = fopen(filename, "r")) == NULL)
+    return (NULL);
+
+  do
+  {
+    if (datalen >= datasize)
+    {
+      datasize = datasize ? 2 * datasize : 65536;
+
+      if ((temp = realloc(data, datasize)) == NULL)
+        break;
+
+      data = temp;
+    }
+
+    datalen += bytes = fread(data + datalen, 1, datasize - datalen, fp);
+  }
+  while (bytes > 0);
+
+  if (fp != stdin)
+    fclose(fp);
+
+  if (datalen > 0 && (temp = realloc(data, datalen)) != NULL)
+    data = temp;
+
+  doc = mmdLoadBufferEx(NULL, data ? data : "", datalen, options);
+
+  free(data);
+
+  return (doc);
+}
+
+
+/*
+ * 'load_feed()' - Load a markdown file using the push parser.
+ *
+ * The file is fed a few bytes at a time so that lines are split between
+ * calls.  When resetting, a partial document with references and open blocks
+ * is fed first and then discarded with @link mmdParserReset@.
+ */
+
+static mmd_t *				/* O - Document or `NULL` on error */
+load_feed(const char   *filename,	/* I - File to load or `NULL` for stdin */
+          mmd_option_t options,		/* I - Markdown options */
+          int          reset)		/* I - Reset the parser first? */
+{
+  FILE		*fp;			/* File to read from */
+  mmd_parser_t	*parser;		/* Parser */
+  mmd_t		*doc = NULL;		/* Document */
+  char		buffer[13];		/* Read buffer, small so lines are split */
+  size_t	bytes;			/* Bytes read */
+  static const char *partial =		/* Partial document for resetting */
+    "[a]: https://www.example.com/a\n"
+    "[b]: https://www.example.com/b\n"
+    "\n"
+    "- list item\n"
+    "  > quote\n"
+    "  > ```\n"
+    "  > code";
+
+
+  if (!filename)
+    fp = stdin;
+  else if ((fp = fopen(filename, "r")) == NULL)
+    return (NULL);
+
+  if ((parser = mmdParserNewEx(NULL, options)) != NULL)
+  {
+    if (!reset || (mmdParserFeed(parser, partial, strlen(partial)) && mmdParserReset(parser, NULL)))
+    {
+      while ((bytes = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+      {
+        if (!mmdParserFeed(parser, buffer, bytes))
+          break;
+      }
+
+      if (!bytes)
+        doc = mmdParserFinish(parser);
+    }
+
+    mmdParserDelete(parser);
+  }
+
+  if (fp != stdin)
+    fclose(fp);
+
+  return (doc);
+}
+
+
 /*
  * 'make_anchor()' - Make an anchor for internal links.
  */
@@ -409,8 +560,9 @@ make_anchor(const char *text)           /* I - Text */
  */
 
 static int				/* O - Exit status */
-run_spec(const char *filename,		/* I - Markdown spec file */
-         FILE       *logfile)		/* I - Log file */
+run_spec(const char   *filename,	/* I - Markdown spec file */
+         FILE         *logfile,		/* I - Log file */
+         mmd_option_t options)		/* I - Markdown options */
 {
   FILE	*fp;				/* File to read from */
   int	number = 0,			/* Current example number */
@@ -422,6 +574,7 @@ run_spec(const char *filename,		/* I - Markdown spec file */
 	html[4096],			/* Expected HTML */
 	*mptr,				/* Pointer into markdown */
 	*hptr;				/* Pointer into HTML */
+  mmd_parser_t *parser;			/* Parser, reused for each example */
 
 
   if (!filename)
@@ -434,6 +587,16 @@ run_spec(const char *filename,		/* I - Markdown spec file */
     return (1);
   }
 
+  if ((parser = mmdParserNewEx(NULL, options)) == NULL)
+  {
+    perror("Unable to create parser");
+
+    if (fp != stdin)
+      fclose(fp);
+
+    return (1);
+  }
+
   while (fgets(line, sizeof(line), fp))
   {
     if (!strncmp(line, "````", 4) && strstr(line, "``` example"))
@@ -496,20 +659,18 @@ run_spec(const char *filename,		/* I - Markdown spec file */
         * Run a test...
         */
 
-        FILE	*infile,		/* Input file */
-		*outfile;		/* Output file */
+        FILE	*outfile;		/* Output file */
         char	outbuffer[4097];	/* Output buffer */
         mmd_t	*doc;			/* Markdown document */
         int	test_passed = 0,	/* Did the test pass? */
 		failed_at = -1;		/* Offset of failure */
 
 
-        infile  = fmemopen(markdown, strlen(markdown), "r");
         outfile = fmemopen(outbuffer, sizeof(outbuffer) - 1, "w");
 
         outbuffer[0] = outbuffer[sizeof(outbuffer) - 1] = '\0';
 
-        if ((doc = mmdLoadFile(NULL, infile)) == NULL)
+        if (!mmdParserReset(parser, NULL) || !mmdParserFeed(parser, markdown, strlen(markdown)) || (doc = mmdParserFinish(parser)) == NULL)
         {
           fputs("FAIL (unable to load)\n", logfile);
           failed ++;
@@ -521,7 +682,6 @@ run_spec(const char *filename,		/* I - Markdown spec file */
 	  mmdFree(doc);
 	}
 
-        fclose(infile);
         fclose(outfile);
 
         if (is_equal(outbuffer, html, &failed_at))
@@ -564,6 +724,8 @@ run_spec(const char *filename,		/* I - Markdown spec file */
     }
   }
 
+  mmdParserDelete(parser);
+
   if (fp != stdin)
     fclose(fp);
 
@@ -585,12 +747,20 @@ usage(void)
 {
   puts("Usage: ./testmmd [options] [filename.md] > filename.html");
   puts("Options:");
+  puts("--buffer          Load the markdown file from a memory buffer");
   puts("--ext all         Support all markdown extensions");
   puts("--ext none        Support no markdown extensions");
+  puts("--feed            Feed the markdown file to a push parser a few bytes at a");
+  puts("                  time");
   puts("--help            Show help");
   puts("--only-body       Only output body content");
+  puts("--reset           Like --feed, but feed a partial document and reset the");
+  puts("                  parser before loading the file");
+  puts("--runs            Merge words with the same formatting into text runs");
+  puts("--spans           Keep the markdown file in memory and reference text in it");
   puts("--spec            Markdown file is a specification with example input and");
   puts("                  expected HTML output");
+  puts("--threads         Parse inline text using multiple threads");
   puts("-o filename.html  Send output to file instead of stdout");
 }
 